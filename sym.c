@@ -25,14 +25,29 @@
  *
  */
 
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 /* define keys */
 /* TODO: restructure this for easier configuration, see suckless tools */
@@ -46,6 +61,12 @@
 	#define KEY_LEFT      CTRLMASK('n')
 	#define KEY_QUIT      CTRLMASK('f')
 	#define KEY_PROCESS_NEW 'a'
+	#define KEY_SNAPSHOT_SAVE 's'
+	#define KEY_SNAPSHOT_LOAD 'l'
+	#define KEY_STEP 'n'
+	#define KEY_PROFILE 'p'
+	#define KEY_BACK 'b'
+	#define KEY_RUN 'u'
 #else
 	#define KEY_DOWN      CTRLMASK('j')
 	#define KEY_UP        CTRLMASK('k')
@@ -55,10 +76,28 @@
 	#define KEY_LEFT      CTRLMASK('l')
 	#define KEY_QUIT      CTRLMASK('c')
 	#define KEY_PROCESS_NEW 'a'
+	#define KEY_SNAPSHOT_SAVE 's'
+	#define KEY_SNAPSHOT_LOAD 'l'
+	#define KEY_STEP 'n'
+	#define KEY_PROFILE 'p'
+	#define KEY_BACK 'b'
+	#define KEY_RUN 'u'
 #endif /* __DVORAK__ */
 
 /* configs */
 #define STRING_MAX_SIZE 128
+#define SNAPSHOT_PATH "sym.snap"
+#define MEMORY_SIZE 65536
+#define QUANTUM 4
+#define DISTRIBUTION_MAX 16 /* values of an empirical distribution */
+#define PRIORITY_MAX 16
+#define DIALOG_ARRAY_MAX 64 /* stages and segments of a process made with a dialog */
+#define HISTORY_INTERVAL 256 /* steps between in memory checkpoints */
+#define HISTORY_MAX 64 /* checkpoints kept, older ones are forgotten */
+#define RUN_MAX 1000000 /* steps of one sim_run() */
+#define RUN_POLL 1024 /* steps between checks for a key stopping sim_run() */
+#define CLIENT_MAX 8 /* clients of the command socket */
+#define COMMAND_BUFFER 65536
 
 /* macros */
 #define CTRLMASK(k) ((k) & 0x1f)
@@ -66,6 +105,29 @@
 #define SIZE(vec) (sizeof(vec)/sizeof((vec)[0]))
 #define VOID_PTR(x) ((void*)(x))
 #define KEYDEF(k, f) printf("%s\033[0;30;41m%s\033[0;30;0m", k, f);
+#define ALIGN8(x) (((x) + 7) & ~(uintptr_t)7)
+#define OFFSET_PTR(o) ((void*)(uintptr_t)(o))
+#define PTR_OFFSET(p) ((uintptr_t)(p))
+#define ALIGNOF(t) __alignof__(t)
+
+/**
+ * Instrumentation, compiled in only with -DSYM_PROFILE (make PROFILE=1).
+ * PROFILE_BEGIN(s) and PROFILE_END(s) must be in the same scope, the time
+ * between them is added to subsystem s. PROFILE_RESTART(s) drops the time
+ * since PROFILE_BEGIN(s), e.g. spent waiting in a dialog.
+ * PROFILE_COUNT(s) only counts.
+ */
+#if defined(SYM_PROFILE)
+	#define PROFILE_BEGIN(s) uint64_t profile_begin_##s = profile_ns()
+	#define PROFILE_END(s) (profile[s].ns += profile_ns() - profile_begin_##s, profile[s].calls++)
+	#define PROFILE_RESTART(s) (profile_begin_##s = profile_ns())
+	#define PROFILE_COUNT(s) (profile[s].calls++)
+#else
+	#define PROFILE_BEGIN(s)
+	#define PROFILE_END(s)
+	#define PROFILE_RESTART(s)
+	#define PROFILE_COUNT(s)
+#endif /* SYM_PROFILE */
 
 /* global variables */
 unsigned int term_h;
@@ -74,13 +136,19 @@ unsigned int term_w;
 /* Linked List of all processes, */
 struct Process* processes;
 
+/* snapshot image the restored processes live in, see snapshot_restore() */
+void* image;
+size_t image_size;
+
 /* structs */
 struct Process {
 
 	/* linked list topology */
 	struct Process* next;
 	struct Process* parent;
+	struct Process* qnext; /* next process in the simulation queue p is in */
 	int parent_pid;
+	int nchildren; /* children not yet terminated, a terminated parent is kept as a zombie until then */
 
 	/* metadata */
 	char name[STRING_MAX_SIZE];
@@ -88,10 +156,10 @@ struct Process {
 	int pid;
 
 	/* times */
-	int t_arrival;
-	int t_length;
-	int t_turnaround;
-	int t_ellapsed;
+	long t_arrival;
+	long t_length;
+	long t_turnaround;
+	long t_ellapsed;
 
 	/* structure of the process */
 	struct Stage {
@@ -102,13 +170,15 @@ struct Process {
 	} *stages;
 	int nstages;
 	int cstage; /* current stage */
+	int t_stage; /* time spent in the current stage */
+	long t_wakeup; /* end of the current io stage, while blocked */
 
 	struct Segment {
 		char name[STRING_MAX_SIZE];
 		int namelen;
 		int t_load;
 		int t_unload;
-		int address;
+		int address; /* -1 when not loaded */
 		int size;
 	} *segments;
 	int nsegments;
@@ -121,14 +191,214 @@ struct Process {
 
 };
 
+/* simulation queues are linked through Process.qnext */
+struct Queue {
+	struct Process* head;
+	struct Process* tail;
+	int length;
+};
+
+/* free block of memory */
+struct Hole {
+	int address;
+	int size;
+};
+
+/**
+ * Random distribution, parameters by type:
+ *   Constant    v[0] value
+ *   Uniform     v[0] minimum, v[1] maximum
+ *   Exponential v[0] mean
+ *   Pareto      v[0] shape, v[1] scale
+ *   Empirical   v[0 .. nv - 1] samples, drawn with equal probability
+ */
+struct Distribution {
+	enum { Constant, Uniform, Exponential, Pareto, Empirical } type;
+	double v[DISTRIBUTION_MAX];
+	int nv;
+};
+
+/**
+ * Synthetic workload generator.
+ * Processes are generated one at a time, in order of arrival, when the
+ * simulation clock reaches the previous one, see sim_generate().
+ */
+struct Workload {
+	uint64_t seed;
+	uint64_t random; /* state of the random number generator */
+	long count; /* processes left to generate, not counting children, -1 for no limit */
+	int pid; /* next pid */
+
+	/* arrival process */
+	enum { Poisson, Bursty, Periodic } arrival;
+	double rate[2]; /* arrivals per time unit, for Bursty one per state */
+	double switching[2]; /* Bursty: rate of leaving each state */
+	double period; /* Periodic */
+	double t_next; /* last arrival */
+	double t_switch; /* Bursty: next change of state */
+	int state; /* Bursty: current state */
+
+	struct Distribution cpu; /* length of computing stages */
+	struct Distribution io; /* length of io stages */
+	struct Distribution stages; /* number of stages */
+	struct Distribution segments; /* number of segments */
+	struct Distribution size; /* size of a segment */
+	struct Distribution fanout; /* children of a process */
+	double priority[PRIORITY_MAX]; /* relative weight of each priority */
+	int npriorities;
+
+	struct Process* parent; /* process whose children are being generated */
+	int children; /* children of parent left to generate */
+};
+
+struct Simulation {
+	long t_now; /* clock */
+	enum { Fcfs, RoundRobin } policy;
+	int quantum;
+	int t_slice; /* time left to the running process before being preempted */
+
+	struct Process* running;
+	struct Queue launched; /* not arrived yet, sorted by arrival */
+	struct Queue acquiring; /* waiting for memory */
+	struct Queue ready;
+	struct Queue blocked; /* doing io, sorted by wakeup */
+
+	/* memory map, sorted by address */
+	struct Hole* holes;
+	int nholes;
+	int choles; /* capacity of holes */
+	int memory_size;
+	int memory_used;
+
+	struct Workload* workload;
+	struct Process* pending; /* last process generated, until it arrives */
+
+	/* statistics */
+	uint64_t nevents;
+	uint64_t nterminated;
+	uint64_t nrejected; /* processes needing more memory than there is */
+	uint64_t nsteps; /* calls to sim_step() which advanced the simulation */
+	long t_turnaround; /* sum of the turnaround times of terminated processes */
+};
+
+/* simulation state, see sim_step() */
+struct Simulation sim;
+
+/* change to the simulation coming from outside, replayed when going back in time */
+struct Mutation {
+	uint64_t step; /* sim.nsteps when the change was made */
+	enum { MutationProcess, MutationPolicy } type;
+	struct Process* p; /* MutationProcess: new process, with its stages and segments */
+	char policy[STRING_MAX_SIZE]; /* MutationPolicy: see sim_policy() */
+};
+
+/* snapshot kept in memory */
+struct Checkpoint {
+	uint64_t step;
+	char* buffer;
+	size_t size;
+};
+
+/**
+ * Past of the simulation, to step backwards: a checkpoint every interval
+ * steps and every change made from outside, see history_goto().
+ */
+struct History {
+	int interval;
+	struct Checkpoint checkpoints[HISTORY_MAX];
+	int ncheckpoints;
+	struct Mutation* mutations; /* sorted by step */
+	int nmutations;
+	int cmutations;
+} history;
+
+/* stop conditions of sim_run(), 0 disables a condition */
+struct Until {
+	long t; /* clock reaches t */
+	int pid; /* process pid terminates */
+	int queue; /* more than queue processes are ready */
+	int memory; /* a process has to wait for memory */
+	int hit; /* set when process pid terminates */
+	int interrupt; /* a key stops the run, for the interface */
+} *until; /* conditions of the running sim_run() */
+
+/* source of commands, see command_execute() */
+struct Client {
+	int fd; /* -1 when unused */
+	FILE* out;
+	char buffer[COMMAND_BUFFER]; /* input not executed yet */
+	int length;
+	FILE* batch; /* responses held back between begin and end */
+	char* batched;
+	size_t nbatched;
+} clients[CLIENT_MAX];
+
+int server = -1; /* command socket */
+char* server_path; /* removed at exit */
+
+enum { ProfileStep, ProfileSchedule, ProfileMemory,
+       ProfileRender, ProfileFlush, ProfileInput,
+       ProfileCommand, ProfileProcess, PROFILE_MAX };
+
+#if defined(SYM_PROFILE)
+struct Profile {
+	char* name;
+	int counter; /* only counts, PROFILE_COUNT() */
+	uint64_t calls;
+	uint64_t ns;
+} profile[PROFILE_MAX] = {
+	[ProfileStep]     = { "step" },     /* event dispatch, see sim_step() */
+	[ProfileSchedule] = { "schedule" }, /* pick of the next process to run */
+	[ProfileMemory]   = { "memory" },   /* allocations and frees of the memory map */
+	[ProfileRender]   = { "render" },
+	[ProfileFlush]    = { "flush" },
+	[ProfileInput]    = { "input" },    /* handling of a key in a dialog, without waiting for it */
+	[ProfileCommand]  = { "command" },  /* keys of the main loop and protocol commands, without dialogs */
+	[ProfileProcess]  = { "process", 1 }, /* processes allocated */
+};
+#endif /* SYM_PROFILE */
+
+/**
+ * Header of a snapshot image.
+ * The image is position independent: every pointer stored in it is an offset
+ * from the beginning of the image (0 stands for NULL), so it can be mmapped at
+ * any address and used after a single relocation pass, without parsing.
+ * Layout, every record starting on an 8 byte boundary:
+ *   struct Snapshot
+ *   struct Hole[sim.nholes]
+ *   struct Workload, if any
+ *   for each process, sorted by PID:
+ *     struct Process, struct Stage[nstages], struct Segment[nsegments]
+ * Integers are stored in native byte order.
+ */
+struct Snapshot {
+	unsigned int magic;
+	unsigned int version;
+	uint64_t size;       /* size of the whole image */
+	uint64_t processes;  /* offset of the first process */
+	uint64_t nprocesses;
+	uint64_t holes;      /* offset of the memory map */
+	uint64_t workload;   /* offset of the workload generator, 0 if none */
+	struct Simulation sim;
+};
+
+/* pid and image offset of a process, used while saving */
+struct SnapshotIndex {
+	int pid;
+	uint64_t offset;
+};
+
+#define SNAPSHOT_MAGIC   0x504d5953 /* "SYMP" */
+#define SNAPSHOT_VERSION 4
+
 struct Entry {
 	char* l;
-	int length; /* in case value is a string */
+	int length; /* in case value is a string, allocated elements for ProcessStage and ProcessSegment */
 	void* v;
 	int i;
-	enum { String, Integer, Boolean,
+	enum { String, Integer, Long, Boolean,
 	       ProcessStage, ProcessSegment, ProcessParent } t;
-	int* c;
+	int* c; /* elements of ProcessStage and ProcessSegment entries, NULL for single values */
 	int s; /* subentry selected for ProcessStage and ProcessSegment entries, also used for cursor in string */
 };
 
@@ -148,13 +418,42 @@ struct Dialog {
 /* prototypes */
 int dialog_input(struct Dialog* d);
 int process_insert(struct Process* ps, struct Process* p);
+int process_list_length(struct Process* ps);
+int sim_step();
+int history_apply(struct Mutation* m);
+int history_back();
+int history_mutation(uint64_t step);
+void history_init(int interval);
+int history_step();
+int sim_run(struct Until* u);
+int client_read(struct Client* c);
+int command_execute(char* line, FILE* out);
+int command_listen(char* path);
+void command_close();
+int command_batching();
+int command_poll();
+void until_dialog(struct Until* u);
 struct Dialog* dialog_new(struct Entry* entries, int nentries, int x, int y, int w, int h, int ratio);
 struct Process* process_dialog_new();
-struct Process* process_list_length(struct Process* ps);
 struct Process* process_lookup_by_pid(struct Process* p, int pid);
 void dialog_compute_process(struct Dialog* d, struct Process* p);
+void dialog_resize_process(struct Entry* e);
 void dialog_draw(struct Dialog* d);
 void dialog_free(struct Dialog* d);
+int snapshot_relocate(void* base, size_t size);
+int snapshot_restore(struct Process* ps, char* path);
+int snapshot_save(struct Process* ps, FILE* f);
+int snapshot_write(struct Process* ps, char* path);
+void process_free(struct Process* p);
+void sim_free(struct Process* ps);
+void sim_init();
+int sim_policy(char* s);
+void sim_report(FILE* f, char* separator, char* delimiter);
+void sim_status();
+void sim_launch(struct Process* p);
+int workload_parse(struct Workload* w, char* spec);
+struct Process* workload_next(struct Workload* w);
+void workload_init(struct Workload* w);
 void die(int line, char* format, ...);
 void draw_border(int x, int y, int w, int h);
 void draw_heline(int x, int y, int len);
@@ -171,6 +470,12 @@ void mvprintc(int x, int y, char* str, int len, int w);
 void resize_handler(int sig);
 void unmask_ctrl(char* str, int key);
 void repaint();
+void screen_flush();
+#if defined(SYM_PROFILE)
+void profile_draw();
+uint64_t profile_ns();
+void profile_report(FILE* f, char* separator, char* delimiter);
+#endif /* SYM_PROFILE */
 
 /**
  * Move cursor to (x, y) and print with format.
@@ -278,6 +583,12 @@ void repaint(){
 	system("clear");
 }
 
+void screen_flush(){
+	PROFILE_BEGIN(ProfileFlush);
+	fflush(stdout);
+	PROFILE_END(ProfileFlush);
+}
+
 /* functions */
 void draw_border(int x, int y, int w, int h){
 	CURSORTO(x, y);
@@ -342,19 +653,11 @@ struct Dialog* dialog_new(struct Entry* entries, int nentries, int x, int y, int
 			d->entries[i].length = strlen((char*)(entries[i].v));
 			break;
 		case ProcessStage:
-			/* TODO: implement variable size arrays, see dialog_compute() */
-			d->entries[i].v = malloc(sizeof(struct Stage*) * (*d->entries[i].c));
-			for(int j = 0; j < (*d->entries[i].c); j++) {
-				((struct Stage*)(d->entries[i].v))[j].type = Computing;
-				((struct Stage*)(d->entries[i].v))[j].t_length = 0;
-				sprintf(((struct Stage*)(d->entries[i].v))[j].name, "stage %d", j + 1);
-				((struct Stage*)(d->entries[i].v))[j].namelen = strlen(
-					((struct Stage*)(d->entries[i].v))[j].name
-				);
-				d->entries[i].s = 0;
-			}
-			break;
 		case ProcessSegment:
+			d->entries[i].v = NULL;
+			d->entries[i].length = 0;
+			d->entries[i].s = 0;
+			dialog_resize_process(d->entries + i);
 			break;
 		}
 	}
@@ -373,13 +676,14 @@ struct Dialog* dialog_new(struct Entry* entries, int nentries, int x, int y, int
 
 void dialog_free(struct Dialog* d){
 	for(int i = 0; i < d->nentries; i++)
-		if(d->entries[i].c != 1)
+		if(d->entries[i].c != NULL)
 			free(d->entries[i].v);
 	free(d);
 }
 
 void dialog_draw(struct Dialog* d){
 
+	PROFILE_BEGIN(ProfileRender);
 	d->w = term_w - 10;
 	d->h = term_h - 10;
 
@@ -389,7 +693,7 @@ void dialog_draw(struct Dialog* d){
 
 	d->nelements = 0;
 	for(int i = 0; i < d->nentries; i++) {
-		if(d->entries[i].c != 1)
+		if(d->entries[i].c != NULL)
 			d->nelements += *d->entries[i].c;
 	}
 
@@ -428,6 +732,20 @@ void dialog_draw(struct Dialog* d){
 				 *((int*)(d->entries[i].v)));
 			scrolled++;
 			break;
+		case Long:
+			if(d->selected == i)
+				printf("\033[0;30;41m");
+			mvprintc(d->x + 1,
+				  d->y + 1 + scrolled,
+				  d->entries[i].l,
+				  strlen(d->entries[i].l),
+				  d->ratio - 1);
+			mvprintf(d->x + d->ratio + 1,
+				 d->y + 1 + scrolled,
+				 "%ld",
+				 *((long*)(d->entries[i].v)));
+			scrolled++;
+			break;
 		case ProcessStage:
 			/* TODO: better printing */
 			for(int j = 0; scrolled < i + *d->entries[i].c && scrolled < d->h - 2; j++) {
@@ -466,9 +784,11 @@ void dialog_draw(struct Dialog* d){
 	}
 
 	draw_veline(d->x + d->ratio, d->y, d->h - 2);
+	PROFILE_END(ProfileRender);
 }
 
 void dialog_status(){
+	PROFILE_BEGIN(ProfileRender);
 	CURSORTO(0, term_w);
 	char k[3];
 	unmask_ctrl(k, KEY_QUIT);
@@ -485,19 +805,21 @@ void dialog_status(){
 	KEYDEF(k, "jump up");
 	unmask_ctrl(k, KEY_RIGHT);
 	KEYDEF(k, "right");
+	PROFILE_END(ProfileRender);
 }
 
 int dialog_input(struct Dialog* d){
 
-	char key;
+	char key = getchar();
+	PROFILE_BEGIN(ProfileInput);
 	int scrolled = 0; /* keep track of the current cursor position */
-	switch(key = getchar()) {
+	switch(key) {
 		case KEY_UP:
 			next:
-			if(d->entries[d->selected].c != 1
+			if(d->entries[d->selected].c != NULL
 			&& d->cselected > 0) {
 				d->cselected--;
-			} else if(d->entries[d->selected - 1].c != 1) {
+			} else if(d->entries[d->selected - 1].c != NULL) {
 				d->cselected = *(d->entries[d->selected - 1].c) - 1;
 				d->selected--;
 			} else {
@@ -506,7 +828,7 @@ int dialog_input(struct Dialog* d){
 			break;
 		case KEY_DOWN:
 			prev:
-			if(d->entries[d->selected].c != 1
+			if(d->entries[d->selected].c != NULL
 			&& d->cselected < *(d->entries[d->selected].c) - 1) {
 				d->cselected++;
 			} else {
@@ -531,6 +853,7 @@ int dialog_input(struct Dialog* d){
 				d->entries[d->selected].s--;
 			break;
 		case KEY_QUIT:
+			PROFILE_END(ProfileInput);
 			return 0;
 		case '\033':
 			getchar();
@@ -601,6 +924,10 @@ int dialog_input(struct Dialog* d){
 				*((int*)(d->entries[d->selected].v)) =
 				*((int*)(d->entries[d->selected].v)) * 10 + key - 0x30;
 				break;
+			case Long:
+				*((long*)(d->entries[d->selected].v)) =
+				*((long*)(d->entries[d->selected].v)) * 10 + key - 0x30;
+				break;
 			case ProcessStage:
 				switch(d->entries[d->selected].s) {
 				case 1:
@@ -623,6 +950,9 @@ int dialog_input(struct Dialog* d){
 				((char*)(d->entries[d->selected].v))[d->entries[d->selected].length] = '\0';
 				d->entries[d->selected].length--;
 				break;
+			case Long:
+				*((long*)(d->entries[d->selected].v)) /= 10;
+				break;
 			case ProcessParent:
 			case Integer:
 				*((int*)(d->entries[d->selected].v)) /= 10;
@@ -649,13 +979,14 @@ int dialog_input(struct Dialog* d){
 	char c[3];
 	unmask_ctrl(c, key);
 	mvprintf(0, 0, "%s", c);
+	PROFILE_END(ProfileInput);
 	return 1;
 }
 
 
-struct Process* process_list_length(struct Process* ps){
+int process_list_length(struct Process* ps){
 	int len = 0;
-	for(struct Process* p = ps; p != NULL; p = p->next) len++;
+	for(struct Process* p = ps->next; p != NULL; p = p->next) len++;
 	return len;
 }
 
@@ -681,114 +1012,2163 @@ int process_check_validity(struct Process* ps){
 	return 0;
 }
 
+/**
+ * Insert process p in the list ps, keeping it sorted by PID.
+ * ps is the head of the list and never holds a process itself.
+ * Return codes:
+ * 0 a process with the same PID already exists
+ * 1 process inserted
+ */
 int process_insert(struct Process* ps, struct Process* p){
-	for(struct Process* p = ps; p != NULL; p = p->next) {
-		if(p->next == NULL) {
-			p->next = malloc(sizeof(struct Process));
-			p->next = p;
+	for(struct Process* q = ps; q != NULL; q = q->next) {
+		if(q->next == NULL || q->next->pid > p->pid) {
+			p->next = q->next;
+			q->next = p;
 			return 1;
-		} else if(p->next->pid == p->pid) {
+		} else if(q->next->pid == p->pid) {
 			return 0;
-		} else if(p->next->pid < p->pid) {
-			struct Process* new = malloc(sizeof(struct Process));
-			new->next = p->next;
-			p->next = new;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Free process p, unless it lives inside the current snapshot image.
+ */
+void process_free(struct Process* p){
+	char* i = image;
+	if(p == NULL || ((char*)p >= i && (char*)p < i + image_size))
+		return;
+	free(p->stages);
+	free(p->segments);
+	free(p);
+}
+
+/**
+ * Remove process p from the list ps.
+ * Return codes:
+ * 0 p is not in the list
+ * 1 process removed
+ */
+int process_remove(struct Process* ps, struct Process* p){
+	for(struct Process* q = ps; q->next != NULL; q = q->next) {
+		if(q->next == p) {
+			q->next = p->next;
+			p->next = NULL;
 			return 1;
+		} else if(q->next->pid > p->pid) {
+			return 0;
 		}
 	}
+	return 0;
+}
+
+void queue_push(struct Queue* q, struct Process* p){
+	p->qnext = NULL;
+	if(q->tail != NULL)
+		q->tail->qnext = p;
+	else
+		q->head = p;
+	q->tail = p;
+	q->length++;
+}
+
+struct Process* queue_pop(struct Queue* q){
+	struct Process* p = q->head;
+	if(p == NULL)
+		return NULL;
+	if((q->head = p->qnext) == NULL)
+		q->tail = NULL;
+	p->qnext = NULL;
+	q->length--;
+	return p;
 }
 
 /**
- * Auxiliary function for the dialog object.
- * Function to validate ProcessStage and ProcessSegment entries.
- * TODO:
- *   - Implement variable size arrays
+ * Insert p in q, keeping it sorted by arrival.
+ * Processes arriving at the same time keep their insertion order.
  */
-void dialog_compute_process(struct Dialog* d, struct Process* p){
-	struct Process* tmp;
-	for(int i = 0; i < d->nentries; i++) {
-		switch(d->entries[i].t) {
-		case ProcessStage:
-			p->t_length = 0;
-			for(int j = 0; j < *d->entries[i].c; j++) {
-				p->t_length += ((struct Stage*)(d->entries[i].v))[j].t_length;
-			}
-			break;
-		case ProcessSegment:
-			break;
-		case ProcessParent: /* TODO: refine this part */
-			if(tmp = process_lookup_by_pid(processes, p) != NULL)
-				p->parent = tmp;
-			break;
+void queue_insert_by_arrival(struct Queue* q, struct Process* p){
+	if(q->tail == NULL || q->tail->t_arrival <= p->t_arrival) {
+		queue_push(q, p);
+		return;
+	}
+	struct Process** i = &q->head;
+	while((*i)->t_arrival <= p->t_arrival)
+		i = &(*i)->qnext;
+	p->qnext = *i;
+	*i = p;
+	q->length++;
+}
+
+/**
+ * Insert p in q, keeping it sorted by the end of its io stage.
+ * Processes waking up at the same time keep their insertion order.
+ */
+void queue_insert_by_wakeup(struct Queue* q, struct Process* p){
+	if(q->tail == NULL || q->tail->t_wakeup <= p->t_wakeup) {
+		queue_push(q, p);
+		return;
+	}
+	struct Process** i = &q->head;
+	while((*i)->t_wakeup <= p->t_wakeup)
+		i = &(*i)->qnext;
+	p->qnext = *i;
+	*i = p;
+	q->length++;
+}
+
+void memory_init(int size){
+	if(sim.choles < 1) {
+		sim.choles = 16;
+		if((sim.holes = realloc(sim.holes, sizeof(struct Hole) * sim.choles)) == NULL)
+			die(__LINE__, "malloc failed");
+	}
+	sim.holes[0].address = 0;
+	sim.holes[0].size = size;
+	sim.nholes = size > 0;
+	sim.memory_size = size;
+	sim.memory_used = 0;
+}
+
+/**
+ * Allocate size units of memory, first fit.
+ * Return the address of the block or -1 when there's no hole big enough.
+ */
+int memory_alloc(int size){
+	PROFILE_BEGIN(ProfileMemory);
+	for(int i = 0; i < sim.nholes; i++) {
+		if(sim.holes[i].size < size)
+			continue;
+		int address = sim.holes[i].address;
+		sim.holes[i].address += size;
+		sim.holes[i].size -= size;
+		if(sim.holes[i].size == 0) {
+			sim.nholes--;
+			memmove(sim.holes + i, sim.holes + i + 1, sizeof(struct Hole) * (sim.nholes - i));
 		}
+		sim.memory_used += size;
+		PROFILE_END(ProfileMemory);
+		return address;
 	}
+	PROFILE_END(ProfileMemory);
+	return -1;
 }
 
-struct Process* process_dialog_new(){
-	static int pid = 1; /* easiest way to keep track of the pids, will change in future */
+/**
+ * Give back a block obtained from memory_alloc(), merging it with the holes around it.
+ */
+void memory_free(int address, int size){
+	PROFILE_BEGIN(ProfileMemory);
+	int lo = 0, hi = sim.nholes;
+	while(lo < hi) { /* first hole after the block */
+		int mid = (lo + hi) / 2;
+		if(sim.holes[mid].address < address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	struct Process* p = malloc(sizeof(struct Process));
-	strcpy(p->name, "Hello, World!");
-	p->pid = pid;
-	p->nstages = 3;
-	p->nsegments = 0;
+	int prev = lo > 0 && sim.holes[lo - 1].address + sim.holes[lo - 1].size == address;
+	int next = lo < sim.nholes && address + size == sim.holes[lo].address;
+	if(prev && next) {
+		sim.holes[lo - 1].size += size + sim.holes[lo].size;
+		sim.nholes--;
+		memmove(sim.holes + lo, sim.holes + lo + 1, sizeof(struct Hole) * (sim.nholes - lo));
+	} else if(prev) {
+		sim.holes[lo - 1].size += size;
+	} else if(next) {
+		sim.holes[lo].address = address;
+		sim.holes[lo].size += size;
+	} else {
+		if(sim.nholes == sim.choles) {
+			sim.choles *= 2;
+			if((sim.holes = realloc(sim.holes, sizeof(struct Hole) * sim.choles)) == NULL)
+				die(__LINE__, "malloc failed");
+		}
+		memmove(sim.holes + lo + 1, sim.holes + lo, sizeof(struct Hole) * (sim.nholes - lo));
+		sim.holes[lo].address = address;
+		sim.holes[lo].size = size;
+		sim.nholes++;
+	}
+	sim.memory_used -= size;
+	PROFILE_END(ProfileMemory);
+}
+
+/**
+ * Load every segment of p, or none of them.
+ * Return 1 on success, 0 when memory is not enough.
+ */
+int process_acquire(struct Process* p){
+	for(int i = 0; i < p->nsegments; i++) {
+		if(p->segments[i].size <= 0)
+			continue;
+		if((p->segments[i].address = memory_alloc(p->segments[i].size)) < 0) {
+			while(i-- > 0)
+				if(p->segments[i].address >= 0) {
+					memory_free(p->segments[i].address, p->segments[i].size);
+					p->segments[i].address = -1;
+				}
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void process_release(struct Process* p){
+	for(int i = 0; i < p->nsegments; i++)
+		if(p->segments[i].address >= 0) {
+			memory_free(p->segments[i].address, p->segments[i].size);
+			p->segments[i].address = -1;
+		}
+}
+
+/**
+ * Skip the stages p has completed.
+ * Return 1 when p has stages left.
+ */
+int process_next_stage(struct Process* p){
+	while(p->cstage < p->nstages && p->t_stage >= p->stages[p->cstage].t_length) {
+		p->cstage++;
+		p->t_stage = 0;
+	}
+	return p->cstage < p->nstages;
+}
+
+/**
+ * Remove a terminated process from the process list, together with its
+ * zombie ancestors which were only waiting for it.
+ */
+void sim_reap(struct Process* p){
+	while(p != NULL) {
+		struct Process* parent = p->parent;
+		process_remove(processes, p);
+		process_free(p);
+		if(parent == NULL || --parent->nchildren > 0 || parent->status != Zombie)
+			break;
+		p = parent;
+	}
+}
+
+void sim_place(struct Process* p);
+
+/* processes waiting for memory are admitted in order of arrival */
+void sim_acquire(){
+	while(sim.acquiring.head != NULL && process_acquire(sim.acquiring.head))
+		sim_place(queue_pop(&sim.acquiring));
+}
+
+void sim_terminate(struct Process* p){
+	process_release(p);
+	p->status = Terminated;
+	p->t_turnaround = sim.t_now - p->t_arrival;
+	sim.nterminated++;
+	sim.t_turnaround += p->t_turnaround;
+	sim.nevents++;
+	if(until != NULL && until->pid == p->pid)
+		until->hit = 1;
+	sim_acquire();
+	if(p->nchildren > 0)
+		p->status = Zombie;
+	else
+		sim_reap(p);
+}
+
+/**
+ * Put p, which has just arrived, acquired memory or finished a stage,
+ * in the queue its current stage needs.
+ */
+void sim_place(struct Process* p){
+	if(!process_next_stage(p)) {
+		sim_terminate(p);
+		return;
+	}
+	sim.nevents++;
+	if(p->stages[p->cstage].type == Io) {
+		p->status = Blocked;
+		p->t_wakeup = sim.t_now + p->stages[p->cstage].t_length - p->t_stage;
+		queue_insert_by_wakeup(&sim.blocked, p);
+	} else {
+		p->status = Ready;
+		queue_push(&sim.ready, p);
+	}
+}
+
+void sim_admit(struct Process* p){
+	sim.nevents++;
+	if(p->memory > sim.memory_size) {
+		sim.nrejected++;
+		sim_terminate(p);
+	} else if(sim.acquiring.head == NULL && process_acquire(p)) {
+		sim_place(p);
+	} else {
+		p->status = Acquiring;
+		queue_push(&sim.acquiring, p);
+	}
+}
+
+/**
+ * Hand a process, already in the process list, to the simulation.
+ * It will enter the system when the clock reaches its arrival.
+ */
+void sim_launch(struct Process* p){
+	p->status = Launched;
+	p->cstage = 0;
+	p->t_stage = 0;
+	p->t_ellapsed = 0;
+	p->t_turnaround = 0;
 	p->memory = 0;
-	p->t_length = 0;
-	p->priority = 0;
-	p->t_arrival = 0;
-	p->parent_pid = 0;
-	p->parent = malloc(sizeof(struct Process));
-	pid++;
+	for(int i = 0; i < p->nsegments; i++) {
+		p->segments[i].address = -1;
+		p->memory += p->segments[i].size;
+	}
+	queue_insert_by_arrival(&sim.launched, p);
+}
 
-	struct Entry entries[] = {
-		{ .l = "Name",           .t = String,         .v = VOID_PTR( p->name),         .i = 1, .c = 1 },
-		{ .l = "PID",            .t = Integer,        .v = VOID_PTR(&p->pid),          .i = 1, .c = 1 },
-		{ .l = "Priority",       .t = Integer,        .v = VOID_PTR(&p->priority),     .i = 1, .c = 1 },
-		{ .l = "Arrival",        .t = Integer,        .v = VOID_PTR(&p->t_arrival),    .i = 1, .c = 1 },
-		{ .l = "Stages",         .t = Integer,        .v = VOID_PTR(&p->nstages),      .i = 1, .c = 1 },
-		{ .l = "",               .t = ProcessStage,   .v = VOID_PTR( p->stages),       .i = 1, .c = &p->nstages },
-		{ .l = "Length",         .t = Integer,        .v = VOID_PTR(&p->t_length),     .i = 0, .c = 1 },
-		{ .l = "Segments",       .t = Integer,        .v = VOID_PTR(&p->nsegments),    .i = 1, .c = 1 },
-		{ .l = "",               .t = ProcessSegment, .v = VOID_PTR( p->segments),     .i = 1, .c = &p->nsegments },
-		{ .l = "Memory",         .t = Integer,        .v = VOID_PTR(&p->memory),       .i = 0, .c = 1 },
-		{ .l = "Parent's PID",   .t = ProcessParent,  .v = VOID_PTR(&p->parent_pid),   .i = 1, .c = 1 },
-	};
+void sim_init(){
+	memset(&sim, 0, sizeof(sim));
+	sim.policy = Fcfs;
+	sim.quantum = QUANTUM;
+	memory_init(MEMORY_SIZE);
+}
 
-	struct Dialog* d = dialog_new(entries, SIZE(entries), 5, 5, term_w - 10, term_h - 10, 10);
+/**
+ * Make sure the next generated process is waiting to arrive.
+ * Only one generated process at a time is kept ahead of the clock, so
+ * memory grows with the processes alive rather than with the workload.
+ */
+void sim_generate(){
+	struct Process* p;
+	if(sim.workload == NULL || sim.pending != NULL)
+		return;
+	if((p = workload_next(sim.workload)) == NULL)
+		return;
+	while(!process_insert(processes, p))
+		p->pid = sim.workload->pid++;
+	sim_launch(p);
+	sim.pending = p;
+}
 
-	int running = 1;
-	do {
-		dialog_draw(d);
-		dialog_status();
-		running = dialog_input(d);
-		dialog_compute_process(d, processes);
-	} while(running);
+/**
+ * Advance the clock to the next event and process every event due at that time:
+ * arrivals, stage completions, preemptions and dispatch.
+ * Return 0 when there is nothing left to simulate.
+ */
+int sim_step(){
+	struct Process* p;
+	long t = -1; /* time of the next event */
+
+	PROFILE_BEGIN(ProfileStep);
+	sim_generate();
+
+	#define EARLIER(x) if(t < 0 || (x) < t) t = (x);
+	if(sim.launched.head != NULL)
+		EARLIER(sim.launched.head->t_arrival);
+	if((p = sim.running) != NULL) {
+		EARLIER(sim.t_now + p->stages[p->cstage].t_length - p->t_stage);
+		if(sim.policy == RoundRobin)
+			EARLIER(sim.t_now + sim.t_slice);
+	}
+	if(sim.blocked.head != NULL)
+		EARLIER(sim.blocked.head->t_wakeup);
+	#undef EARLIER
+	if(t < 0) {
+		PROFILE_END(ProfileStep);
+		return 0;
+	}
+	if(t < sim.t_now) /* launched in the past */
+		t = sim.t_now;
+
+	long dt = t - sim.t_now;
+	sim.t_now = t;
+	if((p = sim.running) != NULL) {
+		p->t_stage += dt;
+		p->t_ellapsed += dt;
+		sim.t_slice -= dt;
+	}
 
-	if (p->parent = process_lookup_by_pid(processes, p->parent_pid) == NULL)
-		free(p->parent);
+	/* io completions, the blocked queue is sorted by wakeup */
+	while(sim.blocked.head != NULL && sim.blocked.head->t_wakeup <= sim.t_now) {
+		p = queue_pop(&sim.blocked);
+		p->t_stage = p->stages[p->cstage].t_length;
+		sim_place(p);
+	}
 
-	dialog_free(d);
-	return p;
+	/* arrivals */
+	while(sim.launched.head != NULL && sim.launched.head->t_arrival <= sim.t_now) {
+		p = queue_pop(&sim.launched);
+		if(p == sim.pending)
+			sim.pending = NULL;
+		sim_admit(p);
+	}
+
+	/* running process */
+	if((p = sim.running) != NULL) {
+		if(p->t_stage >= p->stages[p->cstage].t_length) {
+			if(process_next_stage(p) && p->stages[p->cstage].type == Computing) {
+				sim.nevents++;
+			} else {
+				sim.running = NULL;
+				sim_place(p);
+			}
+		}
+		if(sim.running != NULL && sim.policy == RoundRobin && sim.t_slice <= 0) {
+			sim.running = NULL;
+			sim_place(p);
+		}
+	}
+
+	/* dispatch */
+	PROFILE_BEGIN(ProfileSchedule);
+	if(sim.running == NULL && (p = queue_pop(&sim.ready)) != NULL) {
+		p->status = Executing;
+		sim.running = p;
+		sim.t_slice = sim.quantum;
+		sim.nevents++;
+	}
+	PROFILE_END(ProfileSchedule);
+
+	sim.nsteps++;
+	PROFILE_END(ProfileStep);
+	return 1;
 }
 
-int main(int argc, char** argv){
+/**
+ * xorshift64*, returns a number in (0, 1).
+ */
+double workload_random(struct Workload* w){
+	w->random ^= w->random >> 12;
+	w->random ^= w->random << 25;
+	w->random ^= w->random >> 27;
+	return ((w->random * 2685821657736338717ULL >> 11) + 0.5) / 9007199254740992.0;
+}
 
-	initwin();
+double workload_sample(struct Workload* w, struct Distribution* d){
+	switch(d->type) {
+	case Constant:
+		return d->v[0];
+	case Uniform:
+		return d->v[0] + (d->v[1] - d->v[0]) * workload_random(w);
+	case Exponential:
+		return -d->v[0] * log(workload_random(w));
+	case Pareto:
+		return d->v[1] / pow(workload_random(w), 1 / d->v[0]);
+	case Empirical:
+		return d->v[(int)(workload_random(w) * d->nv)];
+	}
+	return 0;
+}
 
-	processes = malloc(sizeof(struct Process));
-	if(processes == NULL)
-		die(__LINE__, "malloc failed");
+/* sample d rounded to an integer not smaller than min */
+int workload_sample_int(struct Workload* w, struct Distribution* d, int min){
+	double x = floor(workload_sample(w, d) + 0.5);
+	return x < min ? min : x > INT32_MAX ? INT32_MAX : (int)x;
+}
 
-	char key;
-	while(1) {
-		switch(key = getchar()) {
-		case KEY_PROCESS_NEW:
-			printf("%d", process_insert(processes, process_dialog_new()));
+/* time of the next arrival */
+long workload_arrival(struct Workload* w){
+	double x;
+	switch(w->arrival) {
+	case Poisson:
+		w->t_next -= log(workload_random(w)) / w->rate[0];
+		break;
+	case Bursty: /* two state markov modulated poisson process */
+		while(w->t_next + (x = -log(workload_random(w)) / w->rate[w->state]) >= w->t_switch) {
+			w->t_next = w->t_switch;
+			w->state = !w->state;
+			w->t_switch -= log(workload_random(w)) / w->switching[w->state];
+		}
+		w->t_next += x;
+		break;
+	case Periodic:
+		w->t_next += w->period;
+		break;
+	}
+	return (long)w->t_next;
+}
+
+void workload_init(struct Workload* w){
+	memset(w, 0, sizeof(*w));
+	w->seed = 1;
+	w->count = -1;
+	w->pid = 1000;
+	w->arrival = Poisson;
+	w->rate[0] = w->rate[1] = 0.02;
+	w->switching[0] = w->switching[1] = 0.01;
+	w->period = 10;
+	w->cpu = (struct Distribution){ .type = Exponential, .v = { 10 }, .nv = 1 };
+	w->io = (struct Distribution){ .type = Exponential, .v = { 20 }, .nv = 1 };
+	w->stages = (struct Distribution){ .type = Uniform, .v = { 1, 5 }, .nv = 2 };
+	w->segments = (struct Distribution){ .type = Uniform, .v = { 1, 3 }, .nv = 2 };
+	w->size = (struct Distribution){ .type = Exponential, .v = { 64 }, .nv = 1 };
+	w->fanout = (struct Distribution){ .type = Constant, .v = { 0 }, .nv = 1 };
+	w->priority[0] = 1;
+	w->npriorities = 1;
+}
+
+/**
+ * Parse finite numbers separated by colons, with an optional leading colon.
+ * Return the number of values read, -1 on syntax error.
+ */
+int workload_parse_values(char* s, double* v, int max){
+	int n = 0;
+	char* end;
+	if(*s == ':')
+		s++;
+	while(*s != '\0') {
+		if(n == max)
+			return -1;
+		v[n++] = strtod(s, &end);
+		if(end == s || (*end != ':' && *end != '\0') || !isfinite(v[n - 1]))
+			return -1;
+		s = *end == ':' ? end + 1 : end;
+	}
+	return n;
+}
+
+/**
+ * Parse DISTRIBUTION into d, see workload_parse().
+ * Return codes:
+ * 0 no errors
+ * 1 syntax error, or parameters out of range
+ */
+int workload_parse_distribution(struct Distribution* d, char* s){
+	static const struct { char* name; int type; int nv; } types[] = {
+		{ "const",     Constant,    1 },
+		{ "uniform",   Uniform,     2 },
+		{ "exp",       Exponential, 1 },
+		{ "pareto",    Pareto,      2 },
+		{ "empirical", Empirical,   0 },
+	};
+	for(int i = 0; i < SIZE(types); i++) {
+		size_t len = strlen(types[i].name);
+		if(strncmp(s, types[i].name, len))
+			continue;
+		d->nv = workload_parse_values(s + len, d->v, DISTRIBUTION_MAX);
+		d->type = types[i].type;
+		if(d->nv < 1 || (types[i].nv && d->nv != types[i].nv))
+			return 1;
+		switch(d->type) {
+		case Uniform:
+			return d->v[0] > d->v[1];
+		case Exponential:
+			return d->v[0] <= 0;
+		case Pareto:
+			return d->v[0] <= 0 || d->v[1] <= 0;
+		}
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Parse a workload specification, key=value pairs separated by spaces or commas:
+ *   seed=N count=N pid=N
+ *   arrival=poisson:RATE | mmpp:RATE0:RATE1:SWITCH0:SWITCH1 | periodic:PERIOD
+ *   cpu, io, stages, segments, size, fanout = DISTRIBUTION
+ *     const:V | uniform:MIN:MAX | exp:MEAN | pareto:SHAPE:SCALE | empirical:V0:V1:...
+ *   priority=W0:W1:... relative weight of each priority
+ * count is -1 for no limit, pid must be positive, means and pareto
+ * parameters must be positive and uniform needs MIN <= MAX.
+ * Stages alternate between computing and io, starting with computing.
+ * Children arrive right after their parent and don't have children themselves.
+ * Return codes:
+ * 0 no errors
+ * 1 syntax error
+ */
+int workload_parse(struct Workload* w, char* spec){
+	double v[DISTRIBUTION_MAX];
+	char *value, *end;
+	int n;
+
+	for(char* key = strtok(spec, " ,"); key != NULL; key = strtok(NULL, " ,")) {
+		if((value = strchr(key, '=')) == NULL)
+			return 1;
+		*value++ = '\0';
+		if(!strcmp(key, "seed")) {
+			w->seed = strtoull(value, &end, 10);
+			if(end == value || *end != '\0' || *value == '-')
+				return 1;
+		} else if(!strcmp(key, "count")) {
+			w->count = strtol(value, &end, 10);
+			if(end == value || *end != '\0' || w->count < -1)
+				return 1;
+		} else if(!strcmp(key, "pid")) {
+			long pid = strtol(value, &end, 10);
+			if(end == value || *end != '\0' || pid < 1 || pid > INT32_MAX)
+				return 1;
+			w->pid = pid;
+		} else if(!strncmp(value, "poisson", 7) && !strcmp(key, "arrival")) {
+			if(workload_parse_values(value + 7, v, 1) != 1 || v[0] <= 0)
+				return 1;
+			w->arrival = Poisson;
+			w->rate[0] = v[0];
+		} else if(!strncmp(value, "mmpp", 4) && !strcmp(key, "arrival")) {
+			if(workload_parse_values(value + 4, v, 4) != 4 || v[0] <= 0 || v[1] <= 0 || v[2] <= 0 || v[3] <= 0)
+				return 1;
+			w->arrival = Bursty;
+			memcpy(w->rate, v, sizeof(w->rate));
+			memcpy(w->switching, v + 2, sizeof(w->switching));
+		} else if(!strncmp(value, "periodic", 8) && !strcmp(key, "arrival")) {
+			if(workload_parse_values(value + 8, v, 1) != 1 || v[0] <= 0)
+				return 1;
+			w->arrival = Periodic;
+			w->period = v[0];
+		} else if(!strcmp(key, "priority")) {
+			double total = 0;
+			if((n = workload_parse_values(value, w->priority, PRIORITY_MAX)) < 1)
+				return 1;
+			for(int i = 0; i < n; i++) {
+				if(w->priority[i] < 0)
+					return 1;
+				total += w->priority[i];
+			}
+			if(total <= 0)
+				return 1;
+			w->npriorities = n;
+		} else {
+			static const struct { char* key; size_t offset; } distributions[] = {
+				{ "cpu",      offsetof(struct Workload, cpu) },
+				{ "io",       offsetof(struct Workload, io) },
+				{ "stages",   offsetof(struct Workload, stages) },
+				{ "segments", offsetof(struct Workload, segments) },
+				{ "size",     offsetof(struct Workload, size) },
+				{ "fanout",   offsetof(struct Workload, fanout) },
+			};
+			int i;
+			for(i = 0; i < SIZE(distributions); i++)
+				if(!strcmp(key, distributions[i].key))
+					break;
+			if(i == SIZE(distributions)
+			|| workload_parse_distribution(VOID_PTR((char*)w + distributions[i].offset), value))
+				return 1;
+		}
+	}
+
+	w->random = w->seed ? w->seed : 1;
+	w->t_switch = -log(workload_random(w)) / w->switching[0];
+	return 0;
+}
+
+/**
+ * Generate the next process of the workload, NULL when the workload is over.
+ * The process is not inserted in the process list.
+ */
+struct Process* workload_next(struct Workload* w){
+	struct Process* p;
+	double x;
+	int i;
+
+	if(w->children == 0) {
+		if(w->count == 0)
+			return NULL;
+		if(w->count > 0)
+			w->count--;
+	}
+
+	if((p = calloc(1, sizeof(struct Process))) == NULL)
+		die(__LINE__, "malloc failed");
+	PROFILE_COUNT(ProfileProcess);
+	p->pid = w->pid++;
+	sprintf(p->name, "w%d", p->pid);
+	p->t_arrival = workload_arrival(w);
+
+	x = 0;
+	for(i = 0; i < w->npriorities; i++)
+		x += w->priority[i];
+	x *= workload_random(w);
+	for(i = 0; i < w->npriorities - 1 && x >= w->priority[i]; i++)
+		x -= w->priority[i];
+	p->priority = i;
+
+	p->nstages = workload_sample_int(w, &w->stages, 1);
+	if((p->stages = calloc(p->nstages, sizeof(struct Stage))) == NULL)
+		die(__LINE__, "malloc failed");
+	for(i = 0; i < p->nstages; i++) {
+		struct Stage* s = p->stages + i;
+		s->type = i % 2 ? Io : Computing;
+		s->t_length = workload_sample_int(w, s->type == Io ? &w->io : &w->cpu, 1);
+		s->namelen = sprintf(s->name, "%s %d", s->type == Io ? "io" : "cpu", i + 1);
+		p->t_length += s->t_length;
+	}
+
+	p->nsegments = workload_sample_int(w, &w->segments, 0);
+	if(p->nsegments > 0 && (p->segments = calloc(p->nsegments, sizeof(struct Segment))) == NULL)
+		die(__LINE__, "malloc failed");
+	for(i = 0; i < p->nsegments; i++) {
+		p->segments[i].namelen = sprintf(p->segments[i].name, "segment %d", i + 1);
+		p->segments[i].size = workload_sample_int(w, &w->size, 1);
+		p->segments[i].address = -1;
+	}
+
+	if(w->children > 0) {
+		p->parent = w->parent;
+		p->parent_pid = w->parent->pid;
+		if(--w->children == 0)
+			w->parent = NULL;
+	} else if((w->children = workload_sample_int(w, &w->fanout, 0)) > 0) {
+		w->parent = p;
+		p->nchildren = w->children;
+	}
+
+	return p;
+}
+
+int snapshot_index_compare(const void* a, const void* b){
+	int x = *(int*)a, y = ((struct SnapshotIndex*)b)->pid;
+	return (x > y) - (x < y);
+}
+
+/* offset of p in the image being saved, 0 for NULL */
+uint64_t snapshot_offset(struct SnapshotIndex* index, uint64_t n, struct Process* p){
+	struct SnapshotIndex* i;
+	if(p == NULL)
+		return 0;
+	i = bsearch(&p->pid, index, n, sizeof(*index), snapshot_index_compare);
+	return i != NULL ? i->offset : 0;
+}
+
+/**
+ * Serialize the process list ps and the simulation state to f,
+ * see struct Snapshot for the format.
+ * Return codes:
+ * 0 no errors
+ * 1 write error
+ */
+int snapshot_save(struct Process* ps, FILE* f){
+	struct SnapshotIndex* index;
+	struct Snapshot h = { .magic = SNAPSHOT_MAGIC, .version = SNAPSHOT_VERSION };
+	struct Workload w;
+	static const char pad[8];
+	struct Process* p;
+	uint64_t offset;
+	uint64_t i;
+
+	for(p = ps->next; p != NULL; p = p->next)
+		h.nprocesses++;
+	if((index = malloc(sizeof(*index) * (h.nprocesses + 1))) == NULL)
+		return 1;
+
+	offset = ALIGN8(sizeof(struct Snapshot));
+	h.holes = sim.nholes ? offset : 0;
+	offset += ALIGN8(sizeof(struct Hole) * sim.nholes);
+	h.workload = sim.workload ? offset : 0;
+	offset += sim.workload ? ALIGN8(sizeof(struct Workload)) : 0;
+	h.processes = h.nprocesses ? offset : 0;
+	for(p = ps->next, i = 0; p != NULL; p = p->next, i++) {
+		index[i].pid = p->pid;
+		index[i].offset = offset;
+		offset += ALIGN8(sizeof(struct Process)
+		               + sizeof(struct Stage) * p->nstages
+		               + sizeof(struct Segment) * p->nsegments);
+	}
+	h.size = offset;
+
+	#define OFFSET(p) OFFSET_PTR(snapshot_offset(index, h.nprocesses, (p)))
+	h.sim = sim;
+	h.sim.running = OFFSET(sim.running);
+	h.sim.pending = OFFSET(sim.pending);
+	struct Queue* queues[] = { &h.sim.launched, &h.sim.acquiring, &h.sim.ready, &h.sim.blocked };
+	for(int j = 0; j < SIZE(queues); j++) {
+		queues[j]->head = OFFSET(queues[j]->head);
+		queues[j]->tail = OFFSET(queues[j]->tail);
+	}
+	h.sim.holes = OFFSET_PTR(h.holes);
+	h.sim.choles = sim.nholes;
+	h.sim.workload = OFFSET_PTR(h.workload);
+
+	fwrite(&h, sizeof(h), 1, f);
+	fwrite(pad, ALIGN8(sizeof(h)) - sizeof(h), 1, f);
+	if(sim.nholes) {
+		fwrite(sim.holes, sizeof(struct Hole), sim.nholes, f);
+		fwrite(pad, ALIGN8(sizeof(struct Hole) * sim.nholes) - sizeof(struct Hole) * sim.nholes, 1, f);
+	}
+	if(sim.workload) {
+		w = *sim.workload;
+		w.parent = OFFSET(w.parent);
+		fwrite(&w, sizeof(w), 1, f);
+		fwrite(pad, ALIGN8(sizeof(w)) - sizeof(w), 1, f);
+	}
+	for(p = ps->next, i = 0; p != NULL; p = p->next, i++) {
+		struct Process r = *p;
+		size_t len = sizeof(struct Process);
+
+		r.next = OFFSET_PTR(p->next ? index[i + 1].offset : 0);
+		r.parent = OFFSET(p->parent);
+		r.qnext = OFFSET(p->qnext);
+		r.stages = OFFSET_PTR(p->nstages ? index[i].offset + len : 0);
+		r.segments = OFFSET_PTR(p->nsegments ? index[i].offset + len + sizeof(struct Stage) * p->nstages : 0);
+
+		fwrite(&r, len, 1, f);
+		if(p->nstages)
+			fwrite(p->stages, sizeof(struct Stage), p->nstages, f);
+		if(p->nsegments)
+			fwrite(p->segments, sizeof(struct Segment), p->nsegments, f);
+		len += sizeof(struct Stage) * p->nstages + sizeof(struct Segment) * p->nsegments;
+		fwrite(pad, ALIGN8(len) - len, 1, f);
+	}
+	#undef OFFSET
+
+	free(index);
+	return ferror(f) ? 1 : 0;
+}
+
+int snapshot_write(struct Process* ps, char* path){
+	FILE* f = fopen(path, "wb");
+	if(f == NULL)
+		return 1;
+	int r = snapshot_save(ps, f);
+	if(fclose(f) != 0)
+		r = 1;
+	return r;
+}
+
+/**
+ * Turn the offsets of the image at base back into pointers, in place.
+ * This is the only fix-up needed after mapping an image: one pass over the
+ * processes, one addition per pointer field.
+ * Return codes:
+ * 0 no errors
+ * 1 not a snapshot
+ * 2 unsupported version
+ * 3 truncated or corrupted image
+ */
+int snapshot_relocate(void* base, size_t size){
+	struct Snapshot* h = base;
+	struct Workload* w;
+	char* b = base;
+
+	if(size < sizeof(struct Snapshot) || h->magic != SNAPSHOT_MAGIC)
+		return 1;
+	if(h->version != SNAPSHOT_VERSION)
+		return 2;
+	if(h->size != size)
+		return 3;
+
+	/* pointer to count objects of type t, 0 is NULL and only valid for no objects */
+	#define RELOCATE_ARRAY(ptr, count, t) \
+		if((count) < 0 || ((count) > 0 && PTR_OFFSET(ptr) == 0)) \
+			return 3; \
+		if(PTR_OFFSET(ptr) && (PTR_OFFSET(ptr) % ALIGNOF(t) || PTR_OFFSET(ptr) > size \
+		|| (uint64_t)(count) * sizeof(t) > size - PTR_OFFSET(ptr))) \
+			return 3; \
+		(ptr) = PTR_OFFSET(ptr) ? VOID_PTR(b + PTR_OFFSET(ptr)) : NULL;
+	/* pointer to one object of type t, or NULL */
+	#define RELOCATE(ptr, t) RELOCATE_ARRAY(ptr, PTR_OFFSET(ptr) != 0, t)
+
+	struct Process* first = OFFSET_PTR(h->processes);
+	RELOCATE(first, struct Process);
+	uint64_t n = 0;
+	for(struct Process* p = first; p != NULL; p = p->next) {
+		if(++n > h->nprocesses)
+			return 3;
+		RELOCATE(p->next, struct Process);
+		RELOCATE(p->parent, struct Process);
+		RELOCATE(p->qnext, struct Process);
+		RELOCATE_ARRAY(p->stages, p->nstages, struct Stage);
+		RELOCATE_ARRAY(p->segments, p->nsegments, struct Segment);
+		if(p->cstage < 0 || p->cstage > p->nstages)
+			return 3;
+	}
+	if(n != h->nprocesses)
+		return 3;
+
+	RELOCATE(h->sim.running, struct Process);
+	RELOCATE(h->sim.pending, struct Process);
+	struct Queue* queues[] = { &h->sim.launched, &h->sim.acquiring, &h->sim.ready, &h->sim.blocked };
+	for(int i = 0; i < SIZE(queues); i++) {
+		RELOCATE(queues[i]->head, struct Process);
+		RELOCATE(queues[i]->tail, struct Process);
+	}
+	RELOCATE_ARRAY(h->sim.holes, h->sim.nholes, struct Hole);
+	RELOCATE(h->sim.workload, struct Workload);
+	if((w = h->sim.workload) != NULL) {
+		RELOCATE(w->parent, struct Process);
+	}
+	#undef RELOCATE_ARRAY
+	#undef RELOCATE
+
+	return 0;
+}
+
+/**
+ * Set the scheduling policy, "fcfs" or "rr[:QUANTUM]".
+ * Return codes:
+ * 0 no errors
+ * 1 unknown policy or invalid quantum
+ */
+int sim_policy(char* s){
+	if(!strcmp(s, "fcfs")) {
+		sim.policy = Fcfs;
+		return 0;
+	} else if(!strncmp(s, "rr", 2) && (s[2] == '\0' || s[2] == ':')) {
+		int quantum = s[2] ? atoi(s + 3) : sim.quantum;
+		if(quantum < 1)
+			return 1;
+		sim.policy = RoundRobin;
+		sim.quantum = quantum;
+		sim.t_slice = quantum;
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Print the statistics of the simulation as "key value" pairs, the
+ * separator goes between a key and its value, delimiter between pairs.
+ */
+void sim_report(FILE* f, char* separator, char* delimiter){
+	char* d = delimiter;
+	fprintf(f, "time%s%ld", separator, sim.t_now);
+	fprintf(f, "%sevents%s%" PRIu64, d, separator, sim.nevents);
+	fprintf(f, "%sterminated%s%" PRIu64, d, separator, sim.nterminated);
+	fprintf(f, "%srejected%s%" PRIu64, d, separator, sim.nrejected);
+	fprintf(f, "%sturnaround%s%.3f", d, separator, sim.nterminated ? (double)sim.t_turnaround / sim.nterminated : 0.0);
+	fprintf(f, "%sprocesses%s%d", d, separator, process_list_length(processes));
+	fprintf(f, "%sready%s%d", d, separator, sim.ready.length);
+	fprintf(f, "%sblocked%s%d", d, separator, sim.blocked.length);
+	fprintf(f, "%sacquiring%s%d", d, separator, sim.acquiring.length);
+	fprintf(f, "%smemory%s%d", d, separator, sim.memory_used);
+}
+
+void sim_status(){
+	PROFILE_BEGIN(ProfileRender);
+	mvprintf(0, 0, "t %ld  running %d  ready %d  blocked %d  acquiring %d  memory %d/%d  terminated %" PRIu64 "\033[K",
+	         sim.t_now, sim.running ? sim.running->pid : 0,
+	         sim.ready.length, sim.blocked.length, sim.acquiring.length,
+	         sim.memory_used, sim.memory_size, sim.nterminated);
+	PROFILE_END(ProfileRender);
+}
+
+#if defined(SYM_PROFILE)
+uint64_t profile_ns(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Print the counters of every subsystem, in the format of sim_report().
+ */
+void profile_report(FILE* f, char* separator, char* delimiter){
+	for(int i = 0; i < PROFILE_MAX; i++) {
+		fprintf(f, "profile_%s_calls%s%" PRIu64 "%s", profile[i].name, separator, profile[i].calls, delimiter);
+		if(!profile[i].counter)
+			fprintf(f, "profile_%s_ns%s%" PRIu64 "%s", profile[i].name, separator, profile[i].ns, delimiter);
+	}
+	fprintf(f, "profile_events_per_second%s%.0f", separator,
+	        profile[ProfileStep].ns ? sim.nevents * 1e9 / profile[ProfileStep].ns : 0.0);
+}
+
+/**
+ * Overlay in the top right corner with the time spent in each subsystem.
+ * Its own drawing is not counted.
+ */
+void profile_draw(){
+	int w = 48, h = PROFILE_MAX + 6;
+	int x = term_w > w ? term_w - w : 0, y = 1;
+	uint64_t frames = profile[ProfileFlush].calls;
+
+	draw_border(x, y, w, h);
+	mvprintf(x + 2, y + 1, "%-10s %10s %10s %10s", "subsystem", "calls", "total ms", "avg ns");
+	for(int i = 0; i < PROFILE_MAX; i++) {
+		if(profile[i].counter)
+			mvprintf(x + 2, y + 2 + i, "%-10s %10" PRIu64 " %10s %10s",
+			         profile[i].name, profile[i].calls, "-", "-");
+		else
+			mvprintf(x + 2, y + 2 + i, "%-10s %10" PRIu64 " %10.2f %10.0f",
+			         profile[i].name, profile[i].calls, profile[i].ns / 1e6,
+			         profile[i].calls ? (double)profile[i].ns / profile[i].calls : 0.0);
+	}
+	mvprintf(x + 2, y + 2 + PROFILE_MAX, "events/s %.0f",
+	         profile[ProfileStep].ns ? sim.nevents * 1e9 / profile[ProfileStep].ns : 0.0);
+	mvprintf(x + 2, y + 3 + PROFILE_MAX, "frame %.1f us",
+	         frames ? (profile[ProfileRender].ns + profile[ProfileFlush].ns) / 1e3 / frames : 0.0);
+}
+#endif /* SYM_PROFILE */
+
+/**
+ * Free the process list ps and the simulation state.
+ */
+void sim_free(struct Process* ps){
+	for(struct Process* p = ps->next, *next; p != NULL; p = next) {
+		next = p->next;
+		process_free(p);
+	}
+	ps->next = NULL;
+	free(sim.holes);
+	free(sim.workload);
+	memset(&sim, 0, sizeof(sim));
+	if(image != NULL)
+		munmap(image, image_size);
+	image = NULL;
+	image_size = 0;
+}
+
+/**
+ * Replace the process list ps and the simulation state with the image at base,
+ * which must be mapped with mmap() and is owned by the simulation from now on.
+ * Restored processes are used in place, only the memory map and the workload
+ * generator, which can grow, are copied out.
+ * Return codes are the ones of snapshot_relocate(), on error base is unmapped.
+ */
+int snapshot_install(struct Process* ps, void* base, size_t size){
+	struct Snapshot* h = base;
+	struct Hole* holes;
+	struct Workload* w = NULL;
+	int r;
+
+	if((r = snapshot_relocate(base, size)) != 0) {
+		munmap(base, size);
+		return r;
+	}
+
+	if((holes = malloc(sizeof(struct Hole) * (h->sim.nholes + 16))) == NULL
+	|| (h->sim.workload != NULL && (w = malloc(sizeof(struct Workload))) == NULL))
+		die(__LINE__, "malloc failed");
+	memcpy(holes, h->sim.holes, sizeof(struct Hole) * h->sim.nholes);
+	if(w != NULL)
+		*w = *h->sim.workload;
+
+	sim_free(ps);
+	sim = h->sim;
+	sim.holes = holes;
+	sim.choles = sim.nholes + 16;
+	sim.workload = w;
+	image = base;
+	image_size = size;
+	ps->next = h->processes ? VOID_PTR((char*)base + h->processes) : NULL;
+	return 0;
+}
+
+/**
+ * Replace the process list ps and the simulation state with the snapshot stored at path.
+ * The file is mapped privately, so several runs can fork off the same
+ * snapshot without touching it.
+ * Return codes are the ones of snapshot_relocate(), plus:
+ * 4 can't open or map the file
+ */
+int snapshot_restore(struct Process* ps, char* path){
+	struct stat st;
+	void* base;
+	int fd;
+
+	if((fd = open(path, O_RDONLY)) < 0)
+		return 4;
+	if(fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return 4;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED)
+		return 4;
+	return snapshot_install(ps, base, st.st_size);
+}
+
+/**
+ * Like snapshot_restore(), from a snapshot saved in memory, which is left untouched.
+ */
+int snapshot_load(struct Process* ps, char* buffer, size_t size){
+	void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(base == MAP_FAILED)
+		return 4;
+	memcpy(base, buffer, size);
+	return snapshot_install(ps, base, size);
+}
+
+/**
+ * Deep copy of p, outside of any list.
+ */
+struct Process* process_copy(struct Process* p){
+	struct Process* c = malloc(sizeof(struct Process));
+	PROFILE_COUNT(ProfileProcess);
+	if(c == NULL)
+		die(__LINE__, "malloc failed");
+	*c = *p;
+	c->next = c->parent = c->qnext = NULL;
+	c->stages = c->nstages > 0 ? malloc(sizeof(struct Stage) * c->nstages) : NULL;
+	c->segments = c->nsegments > 0 ? malloc(sizeof(struct Segment) * c->nsegments) : NULL;
+	if((c->nstages > 0 && c->stages == NULL) || (c->nsegments > 0 && c->segments == NULL))
+		die(__LINE__, "malloc failed");
+	if(c->nstages > 0)
+		memcpy(c->stages, p->stages, sizeof(struct Stage) * c->nstages);
+	if(c->nsegments > 0)
+		memcpy(c->segments, p->segments, sizeof(struct Segment) * c->nsegments);
+	return c;
+}
+
+/**
+ * Apply a change coming from outside the simulation.
+ * Return codes:
+ * 0 no errors
+ * 1 the change was rejected: duplicate pid or invalid policy
+ */
+int sim_apply(struct Mutation* m){
+	struct Process* p;
+	switch(m->type) {
+	case MutationProcess:
+		p = process_copy(m->p);
+		if(!process_insert(processes, p)) {
+			process_free(p);
+			return 1;
+		}
+		if(p->parent_pid != 0 && (p->parent = process_lookup_by_pid(processes, p->parent_pid)) != NULL)
+			p->parent->nchildren++;
+		sim_launch(p);
+		return 0;
+	case MutationPolicy:
+		return sim_policy(m->policy);
+	}
+	return 1;
+}
+
+/**
+ * Forget every checkpoint and change after the current step,
+ * the simulation is taking a different course.
+ */
+void history_truncate(){
+	while(history.ncheckpoints > 0 && history.checkpoints[history.ncheckpoints - 1].step > sim.nsteps)
+		free(history.checkpoints[--history.ncheckpoints].buffer);
+	while(history.nmutations > 0 && history.mutations[history.nmutations - 1].step > sim.nsteps)
+		process_free(history.mutations[--history.nmutations].p);
+}
+
+void history_checkpoint(){
+	struct Checkpoint* c;
+	FILE* f;
+
+	if(history.ncheckpoints > 0 && history.checkpoints[history.ncheckpoints - 1].step >= sim.nsteps)
+		return;
+	if(history.ncheckpoints == HISTORY_MAX) { /* forget the oldest */
+		free(history.checkpoints[0].buffer);
+		memmove(history.checkpoints, history.checkpoints + 1, sizeof(struct Checkpoint) * --history.ncheckpoints);
+		/* changes before the oldest checkpoint can't be replayed anymore */
+		int n = history_mutation(history.checkpoints[0].step);
+		for(int i = 0; i < n; i++)
+			process_free(history.mutations[i].p);
+		memmove(history.mutations, history.mutations + n, sizeof(struct Mutation) * (history.nmutations -= n));
+	}
+	c = history.checkpoints + history.ncheckpoints;
+	if((f = open_memstream(&c->buffer, &c->size)) == NULL)
+		die(__LINE__, "malloc failed");
+	if(snapshot_save(processes, f) | fclose(f))
+		die(__LINE__, "can't save checkpoint\n");
+	c->step = sim.nsteps;
+	history.ncheckpoints++;
+}
+
+/**
+ * Forget the whole history and start it again from the current state.
+ * interval is the number of steps between checkpoints, 0 disables the history.
+ */
+void history_init(int interval){
+	while(history.ncheckpoints > 0)
+		free(history.checkpoints[--history.ncheckpoints].buffer);
+	while(history.nmutations > 0)
+		process_free(history.mutations[--history.nmutations].p);
+	history.interval = interval;
+	if(interval > 0)
+		history_checkpoint();
+}
+
+/**
+ * Apply m and record it, so that it's replayed when going back in time.
+ * Changing the past forgets its future. m->p, if any, is owned by the history.
+ * Return codes are the ones of sim_apply().
+ */
+int history_apply(struct Mutation* m){
+	int r;
+	history_truncate();
+	m->step = sim.nsteps;
+	if((r = sim_apply(m)) != 0 || history.interval == 0) {
+		process_free(m->p);
+		return r;
+	}
+	if(history.nmutations == history.cmutations) {
+		history.cmutations = history.cmutations ? history.cmutations * 2 : 16;
+		if((history.mutations = realloc(history.mutations, sizeof(struct Mutation) * history.cmutations)) == NULL)
+			die(__LINE__, "malloc failed");
+	}
+	history.mutations[history.nmutations++] = *m;
+	return 0;
+}
+
+/* index of the first change recorded at step or later */
+int history_mutation(uint64_t step){
+	int lo = 0, hi = history.nmutations;
+	while(lo < hi) {
+		int mid = (lo + hi) / 2;
+		if(history.mutations[mid].step < step)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * sim_step(), replaying the changes recorded for the new step
+ * when moving forward through the past, and checkpointing periodically.
+ */
+int history_step(){
+	if(!sim_step())
+		return 0;
+	if(history.interval > 0 && sim.nsteps % history.interval == 0)
+		history_checkpoint();
+	for(int i = history_mutation(sim.nsteps); i < history.nmutations && history.mutations[i].step == sim.nsteps; i++)
+		sim_apply(history.mutations + i);
+	return 1;
+}
+
+/**
+ * Bring the simulation back to step target: restore the last checkpoint
+ * before it and replay the steps and changes in between, so the cost is
+ * bounded by the checkpoint interval rather than by the length of the run.
+ * Return codes:
+ * 0 no errors
+ * 1 target is older than every checkpoint
+ */
+int history_goto(uint64_t target){
+	struct Checkpoint* c;
+	int i;
+
+	for(i = history.ncheckpoints - 1; i >= 0 && history.checkpoints[i].step > target; i--)
+		;
+	if(i < 0)
+		return 1;
+	c = history.checkpoints + i;
+	if(snapshot_load(processes, c->buffer, c->size))
+		die(__LINE__, "can't load checkpoint\n");
+
+	for(i = history_mutation(sim.nsteps); i < history.nmutations && history.mutations[i].step == sim.nsteps; i++)
+		sim_apply(history.mutations + i);
+	while(sim.nsteps < target && history_step())
+		;
+	return 0;
+}
+
+/* step backwards, return 0 at the beginning of the history */
+int history_back(){
+	return sim.nsteps > 0 && history_goto(sim.nsteps - 1) == 0;
+}
+
+/* 1 when process pid can still terminate: it's alive or the workload will generate it */
+int sim_alive(int pid){
+	struct Process* p = process_lookup_by_pid(processes->next, pid);
+	struct Workload* w = sim.workload;
+
+	if(p != NULL)
+		return p->status != Zombie && p->status != Terminated;
+	return w != NULL && pid >= w->pid && (w->count != 0 || w->children > 0);
+}
+
+/**
+ * Step until one of the conditions in u holds or the simulation is over,
+ * for at most RUN_MAX steps or, with u->interrupt, until a key is pressed.
+ * At least one step is taken. A generated workload may never end, so
+ * nothing is run without a condition, or when the only condition is a
+ * process which will never terminate.
+ * Return codes:
+ * 0 the simulation is over
+ * 1 a condition holds
+ * 2 no condition can hold
+ * 3 RUN_MAX steps taken or interrupted
+ */
+int sim_run(struct Until* u){
+	uint64_t rejected = sim.nrejected;
+	int r = 3;
+
+	if(u->t <= 0 && (u->pid <= 0 || !sim_alive(u->pid)) && u->queue <= 0 && !u->memory)
+		return 2;
+	until = u;
+	u->hit = 0;
+	for(int i = 0; i < RUN_MAX; i++) {
+		if(!history_step()) {
+			r = 0;
+			break;
+		}
+		if(u->interrupt && i % RUN_POLL == RUN_POLL - 1
+		&& poll(&(struct pollfd){ .fd = STDIN_FILENO, .events = POLLIN }, 1, 0) > 0) {
+			getchar(); /* the key only stops the run */
+			break;
+		}
+		if((u->t > 0 && sim.t_now >= u->t)
+		|| (u->pid > 0 && u->hit)
+		|| (u->queue > 0 && sim.ready.length > u->queue)
+		|| (u->memory && (sim.acquiring.length > 0 || sim.nrejected > rejected))) {
+			r = 1;
+			break;
+		}
+	}
+	until = NULL;
+	return r;
+}
+
+/**
+ * Dialog to choose the conditions of sim_run(), 0 disables a condition.
+ */
+void until_dialog(struct Until* u){
+	struct Entry entries[] = {
+		{ .l = "Until time",     .t = Long,    .v = VOID_PTR(&u->t),      .i = 1, .c = NULL },
+		{ .l = "PID terminates", .t = Integer, .v = VOID_PTR(&u->pid),    .i = 1, .c = NULL },
+		{ .l = "Ready over",     .t = Integer, .v = VOID_PTR(&u->queue),  .i = 1, .c = NULL },
+		{ .l = "Memory full",    .t = Integer, .v = VOID_PTR(&u->memory), .i = 1, .c = NULL },
+	};
+
+	struct Dialog* d = dialog_new(entries, SIZE(entries), 5, 5, term_w - 10, term_h - 10, 18);
+
+	int running = 1;
+	do {
+		dialog_draw(d);
+		dialog_status();
+		screen_flush();
+		running = dialog_input(d);
+	} while(running);
+
+	dialog_free(d);
+	repaint();
+}
+
+/**
+ * Grow the array of a ProcessStage or ProcessSegment entry to its count,
+ * which is clamped to DIALOG_ARRAY_MAX. The array never shrinks and always
+ * has an element, so the count can be edited back and forth and the
+ * selected subentry stays valid.
+ */
+void dialog_resize_process(struct Entry* e){
+	size_t size = e->t == ProcessStage ? sizeof(struct Stage) : sizeof(struct Segment);
+	int n = *e->c;
+
+	if(n > DIALOG_ARRAY_MAX)
+		n = *e->c = DIALOG_ARRAY_MAX;
+	if(n < 1)
+		n = 1;
+	if(n <= e->length)
+		return;
+	if((e->v = realloc(e->v, size * n)) == NULL)
+		die(__LINE__, "malloc failed");
+	for(int j = e->length; j < n; j++) {
+		if(e->t == ProcessStage) {
+			struct Stage* s = (struct Stage*)e->v + j;
+			s->type = Computing;
+			s->t_length = 0;
+			s->namelen = sprintf(s->name, "stage %d", j + 1);
+		} else {
+			struct Segment* s = (struct Segment*)e->v + j;
+			memset(s, 0, sizeof(*s));
+			s->address = -1;
+			s->namelen = sprintf(s->name, "segment %d", j + 1);
+		}
+	}
+	e->length = n;
+}
+
+/**
+ * Auxiliary function for the dialog object.
+ * Function to validate ProcessStage and ProcessSegment entries.
+ */
+void dialog_compute_process(struct Dialog* d, struct Process* p){
+	struct Process* tmp;
+	for(int i = 0; i < d->nentries; i++) {
+		switch(d->entries[i].t) {
+		case ProcessStage:
+			dialog_resize_process(d->entries + i);
+			p->t_length = 0;
+			for(int j = 0; j < *d->entries[i].c; j++) {
+				p->t_length += ((struct Stage*)(d->entries[i].v))[j].t_length;
+			}
+			break;
+		case ProcessSegment:
+			dialog_resize_process(d->entries + i);
+			break;
+		case ProcessParent: /* TODO: refine this part */
+			if((tmp = process_lookup_by_pid(processes, p->parent_pid)) != NULL)
+				p->parent = tmp;
+			break;
+		}
+	}
+}
+
+struct Process* process_dialog_new(){
+	static int pid = 1; /* easiest way to keep track of the pids, will change in future */
+
+	struct Process* p = malloc(sizeof(struct Process));
+	PROFILE_COUNT(ProfileProcess);
+	strcpy(p->name, "Hello, World!");
+	p->pid = pid;
+	p->nstages = 3;
+	p->nsegments = 0;
+	p->memory = 0;
+	p->t_length = 0;
+	p->priority = 0;
+	p->t_arrival = 0;
+	p->parent_pid = 0;
+	p->parent = NULL;
+	p->next = NULL;
+	p->qnext = NULL;
+	p->nchildren = 0;
+	p->stages = NULL;
+	p->segments = NULL;
+	pid++;
+
+	struct Entry entries[] = {
+		{ .l = "Name",           .t = String,         .v = VOID_PTR( p->name),         .i = 1, .c = NULL },
+		{ .l = "PID",            .t = Integer,        .v = VOID_PTR(&p->pid),          .i = 1, .c = NULL },
+		{ .l = "Priority",       .t = Integer,        .v = VOID_PTR(&p->priority),     .i = 1, .c = NULL },
+		{ .l = "Arrival",        .t = Long,           .v = VOID_PTR(&p->t_arrival),    .i = 1, .c = NULL },
+		{ .l = "Stages",         .t = Integer,        .v = VOID_PTR(&p->nstages),      .i = 1, .c = NULL },
+		{ .l = "",               .t = ProcessStage,   .v = VOID_PTR( p->stages),       .i = 1, .c = &p->nstages },
+		{ .l = "Length",         .t = Long,           .v = VOID_PTR(&p->t_length),     .i = 0, .c = NULL },
+		{ .l = "Segments",       .t = Integer,        .v = VOID_PTR(&p->nsegments),    .i = 1, .c = NULL },
+		{ .l = "",               .t = ProcessSegment, .v = VOID_PTR( p->segments),     .i = 1, .c = &p->nsegments },
+		{ .l = "Memory",         .t = Integer,        .v = VOID_PTR(&p->memory),       .i = 0, .c = NULL },
+		{ .l = "Parent's PID",   .t = ProcessParent,  .v = VOID_PTR(&p->parent_pid),   .i = 1, .c = NULL },
+	};
+
+	struct Dialog* d = dialog_new(entries, SIZE(entries), 5, 5, term_w - 10, term_h - 10, 10);
+
+	int running = 1;
+	do {
+		dialog_draw(d);
+		dialog_status();
+		screen_flush();
+		running = dialog_input(d);
+		dialog_compute_process(d, p);
+	} while(running);
+
+	if(p->parent_pid != 0)
+		p->parent = process_lookup_by_pid(processes, p->parent_pid);
+
+	/* the dialog owns the stages and segments while editing, keep them */
+	p->stages = entries[5].v;
+	p->segments = entries[8].v;
+	entries[5].v = entries[8].v = NULL;
+	dialog_free(d);
+	return p;
+}
+
+/**
+ * Command protocol, to drive sym from scripts.
+ * Commands are lines of words separated by spaces, read from stdin in batch
+ * mode (-b -c) or from the clients of a unix socket (-S) while the interface runs.
+ * Every command gets exactly one line back: "ok" followed by key=value pairs,
+ * or "err" followed by a message.
+ *   new [pid=N] [name=S] [arrival=T] [priority=N] [parent=PID] [stages=c10,i5,...] [segments=64,...]
+ *       c for computing and i for io stages, pid defaults to the highest pid + 1
+ *   policy fcfs|rr:QUANTUM
+ *   step [N]    advance N events, 1 by default
+ *   back [N]    go back N events
+ *               step and back reply err when they can't move N events,
+ *               back doesn't move at all in that case
+ *   run [time=T] [pid=PID] [ready=K] [memory=1]    see sim_run(), err when
+ *               no condition can hold or after RUN_MAX steps
+ *   stats       see sim_report()
+ *   profile     see profile_report(), only with SYM_PROFILE
+ *   get PID     the name is quoted, with \" and \\ escaped
+ *   ps          pid:status of every process
+ *   save PATH, load PATH    snapshots
+ *   begin ... end    hold back the responses of the commands in between and
+ *                    send them all at end, the interface redraws once
+ *   quit
+ */
+
+char* status_names[] = {
+	[Launched] = "launched", [Acquiring] = "acquiring",
+	[Ready]    = "ready",    [Executing] = "executing",
+	[Blocked]  = "blocked",  [Zombie]    = "zombie",
+	[Terminated] = "terminated",
+};
+
+/* value of the argument "key=value", NULL if arg is another key */
+char* command_arg(char* arg, char* key){
+	size_t len = strlen(key);
+	return !strncmp(arg, key, len) && arg[len] == '=' ? arg + len + 1 : NULL;
+}
+
+/**
+ * Parse s, a whole number between min and max, into *v.
+ * Return 1 on syntax error or when out of range.
+ */
+int command_number(char* s, long min, long max, long* v){
+	char* end;
+	errno = 0;
+	*v = strtol(s, &end, 10);
+	return end == s || *end != '\0' || errno != 0 || *v < min || *v > max;
+}
+
+/**
+ * Build a process from the arguments of the new command.
+ * Return NULL on syntax error.
+ */
+struct Process* command_process(){
+	struct Process* p = calloc(1, sizeof(struct Process));
+	struct Process* last = processes;
+	char *arg, *v, *end;
+	long n;
+
+	PROFILE_COUNT(ProfileProcess);
+	if(p == NULL)
+		die(__LINE__, "malloc failed");
+	while(last->next != NULL)
+		last = last->next;
+	p->pid = last->pid < INT32_MAX ? last->pid + 1 : 0;
+
+	while((arg = strtok(NULL, " ")) != NULL) {
+		if((v = command_arg(arg, "pid")) != NULL) {
+			if(command_number(v, 1, INT32_MAX, &n))
+				goto invalid;
+			p->pid = n;
+		} else if((v = command_arg(arg, "name")) != NULL) {
+			snprintf(p->name, STRING_MAX_SIZE, "%s", v);
+		} else if((v = command_arg(arg, "arrival")) != NULL) {
+			if(command_number(v, 0, LONG_MAX, &p->t_arrival))
+				goto invalid;
+		} else if((v = command_arg(arg, "priority")) != NULL) {
+			if(command_number(v, 0, INT32_MAX, &n))
+				goto invalid;
+			p->priority = n;
+		} else if((v = command_arg(arg, "parent")) != NULL) {
+			if(command_number(v, 0, INT32_MAX, &n))
+				goto invalid;
+			p->parent_pid = n;
+		} else if((v = command_arg(arg, "stages")) != NULL) {
+			for(char* c = v; *c; c++)
+				p->nstages += *c == ',';
+			p->nstages++;
+			if((p->stages = calloc(p->nstages, sizeof(struct Stage))) == NULL)
+				die(__LINE__, "malloc failed");
+			for(int i = 0; i < p->nstages; i++, v = end + 1) {
+				struct Stage* s = p->stages + i;
+				if(*v != 'c' && *v != 'i')
+					goto invalid;
+				s->type = *v == 'i' ? Io : Computing;
+				n = strtol(v + 1, &end, 10);
+				if(end == v + 1 || n < 0 || n > INT32_MAX || (*end != ',' && *end != '\0'))
+					goto invalid;
+				s->t_length = n;
+				s->namelen = sprintf(s->name, "stage %d", i + 1);
+				p->t_length += s->t_length;
+			}
+		} else if((v = command_arg(arg, "segments")) != NULL) {
+			for(char* c = v; *c; c++)
+				p->nsegments += *c == ',';
+			p->nsegments++;
+			if((p->segments = calloc(p->nsegments, sizeof(struct Segment))) == NULL)
+				die(__LINE__, "malloc failed");
+			for(int i = 0; i < p->nsegments; i++, v = end + 1) {
+				n = strtol(v, &end, 10);
+				if(end == v || n < 0 || n > INT32_MAX || (*end != ',' && *end != '\0'))
+					goto invalid;
+				p->segments[i].size = n;
+				p->segments[i].namelen = sprintf(p->segments[i].name, "segment %d", i + 1);
+			}
+		} else {
+			goto invalid;
+		}
+	}
+	if(p->pid < 1) /* no pid left after the last one */
+		goto invalid;
+	if(p->name[0] == '\0')
+		sprintf(p->name, "p%d", p->pid);
+	return p;
+
+invalid:
+	process_free(p);
+	return NULL;
+}
+
+/* number argument of step and back, 1 by default, -1 when malformed */
+long command_count(){
+	char* arg = strtok(NULL, " ");
+	long n = 1;
+	if(arg != NULL && command_number(arg, 0, LONG_MAX, &n))
+		return -1;
+	return n;
+}
+
+/**
+ * Execute one command, writing its response to out.
+ * Return 0 on quit.
+ */
+int command_execute(char* line, FILE* out){
+	char* cmd = strtok(line, " ");
+	char *arg, *v;
+	struct Process* p;
+	struct Mutation m;
+	long n;
+	int r;
+
+	if(cmd == NULL) {
+		fprintf(out, "err empty command\n");
+	} else if(!strcmp(cmd, "new")) {
+		if((m.p = command_process()) == NULL) {
+			fprintf(out, "err invalid process\n");
+		} else {
+			m.type = MutationProcess;
+			n = m.p->pid;
+			if(history_apply(&m))
+				fprintf(out, "err pid %ld already exists\n", n);
+			else
+				fprintf(out, "ok pid=%ld\n", n);
+		}
+	} else if(!strcmp(cmd, "policy")) {
+		m = (struct Mutation){ .type = MutationPolicy };
+		snprintf(m.policy, STRING_MAX_SIZE, "%s", (arg = strtok(NULL, " ")) ? arg : "");
+		if(history_apply(&m))
+			fprintf(out, "err invalid policy\n");
+		else
+			fprintf(out, "ok\n");
+	} else if(!strcmp(cmd, "step")) {
+		if((n = command_count()) < 0) {
+			fprintf(out, "err invalid count\n");
+		} else {
+			for(; n > 0 && history_step(); n--)
+				;
+			fprintf(out, "%s time=%ld steps=%" PRIu64 "\n", n > 0 ? "err simulation over" : "ok", sim.t_now, sim.nsteps);
+		}
+	} else if(!strcmp(cmd, "back")) {
+		/* a single restore and replay, rather than one per step */
+		if((n = command_count()) < 0)
+			fprintf(out, "err invalid count\n");
+		else if((uint64_t)n > sim.nsteps || history_goto(sim.nsteps - n))
+			fprintf(out, "err no history %ld steps back\n", n);
+		else
+			fprintf(out, "ok time=%ld steps=%" PRIu64 "\n", sim.t_now, sim.nsteps);
+	} else if(!strcmp(cmd, "run")) {
+		struct Until u = { 0 };
+		long t = 0, pid = 0, queue = 0, memory = 0;
+		r = 0;
+		while(!r && (arg = strtok(NULL, " ")) != NULL) {
+			if((v = command_arg(arg, "time")) != NULL)
+				r = command_number(v, 0, LONG_MAX, &t);
+			else if((v = command_arg(arg, "pid")) != NULL)
+				r = command_number(v, 0, INT32_MAX, &pid);
+			else if((v = command_arg(arg, "ready")) != NULL)
+				r = command_number(v, 0, INT32_MAX, &queue);
+			else if((v = command_arg(arg, "memory")) != NULL)
+				r = command_number(v, 0, 1, &memory);
+			else
+				r = 1;
+		}
+		u = (struct Until){ .t = t, .pid = pid, .queue = queue, .memory = memory };
+		if(r)
+			fprintf(out, "err invalid condition\n");
+		else if((r = sim_run(&u)) == 2)
+			fprintf(out, "err no condition can hold\n");
+		else if(r == 3)
+			fprintf(out, "err %d steps taken time=%ld steps=%" PRIu64 "\n", RUN_MAX, sim.t_now, sim.nsteps);
+		else
+			fprintf(out, "ok hit=%d time=%ld steps=%" PRIu64 "\n", r, sim.t_now, sim.nsteps);
+	} else if(!strcmp(cmd, "stats")) {
+		fprintf(out, "ok ");
+		sim_report(out, "=", " ");
+		fprintf(out, "\n");
+	} else if(!strcmp(cmd, "profile")) {
+#if defined(SYM_PROFILE)
+		fprintf(out, "ok ");
+		profile_report(out, "=", " ");
+		fprintf(out, "\n");
+#else
+		fprintf(out, "err built without profiling\n");
+#endif
+	} else if(!strcmp(cmd, "get")) {
+		if((arg = strtok(NULL, " ")) == NULL || command_number(arg, 1, INT32_MAX, &n))
+			fprintf(out, "err invalid pid\n");
+		else if((p = process_lookup_by_pid(processes->next, n)) == NULL)
+			fprintf(out, "err no such process\n");
+		else {
+			fprintf(out, "ok pid=%d name=\"", p->pid);
+			for(char* c = p->name; *c; c++)
+				fprintf(out, *c == '"' || *c == '\\' ? "\\%c" : "%c", *c);
+			fprintf(out, "\" status=%s priority=%d parent=%d arrival=%ld length=%ld ellapsed=%ld stage=%d memory=%d\n",
+			        status_names[p->status], p->priority, p->parent_pid,
+			        p->t_arrival, p->t_length, p->t_ellapsed, p->cstage, p->memory);
+		}
+	} else if(!strcmp(cmd, "ps")) {
+		fprintf(out, "ok");
+		for(p = processes->next; p != NULL; p = p->next)
+			fprintf(out, " %d:%s", p->pid, status_names[p->status]);
+		fprintf(out, "\n");
+	} else if(!strcmp(cmd, "save") || !strcmp(cmd, "load")) {
+		if((arg = strtok(NULL, " ")) == NULL) {
+			fprintf(out, "err missing path\n");
+		} else {
+			if(cmd[0] == 's') {
+				r = snapshot_write(processes, arg);
+			} else if((r = snapshot_restore(processes, arg)) == 0) {
+				history_init(history.interval);
+			}
+			if(r)
+				fprintf(out, "err %d\n", r);
+			else
+				fprintf(out, "ok\n");
+		}
+	} else if(!strcmp(cmd, "quit")) {
+		fprintf(out, "ok\n");
+		return 0;
+	} else {
+		fprintf(out, "err unknown command %s\n", cmd);
+	}
+	return 1;
+}
+
+/**
+ * Read what's available from client c and execute every complete line.
+ * Return 0 when the client is gone or has quit.
+ */
+int client_read(struct Client* c){
+	char *line, *nl;
+	int running = 1;
+	ssize_t n;
+
+	if((n = read(c->fd, c->buffer + c->length, sizeof(c->buffer) - c->length - 1)) <= 0)
+		return 0;
+	c->length += n;
+	c->buffer[c->length] = '\0';
+
+	for(line = c->buffer; running && (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+		*nl = '\0';
+		if(nl > line && nl[-1] == '\r')
+			nl[-1] = '\0';
+		if(!strcmp(line, "begin") && c->batch == NULL) {
+			if((c->batch = open_memstream(&c->batched, &c->nbatched)) == NULL)
+				die(__LINE__, "malloc failed");
+		} else if(!strcmp(line, "end") && c->batch != NULL) {
+			fclose(c->batch);
+			fwrite(c->batched, 1, c->nbatched, c->out);
+			free(c->batched);
+			c->batch = NULL;
+		} else {
+			PROFILE_BEGIN(ProfileCommand);
+			running = command_execute(line, c->batch != NULL ? c->batch : c->out);
+			PROFILE_END(ProfileCommand);
+		}
+	}
+
+	c->length -= line - c->buffer;
+	memmove(c->buffer, line, c->length);
+	if(c->length == sizeof(c->buffer) - 1) {
+		fprintf(c->out, "err line too long\n");
+		c->length = 0;
+	}
+	fflush(c->out);
+	return running;
+}
+
+void client_close(struct Client* c){
+	if(c->batch != NULL) {
+		fclose(c->batch);
+		free(c->batched);
+	}
+	fclose(c->out);
+	c->fd = -1;
+}
+
+/**
+ * Listen for clients on the unix socket at path, which is removed at exit.
+ * A socket left at path by a previous run is replaced, anything else is kept.
+ * Return codes:
+ * 0 no errors
+ * 1 can't create the socket
+ * 2 path exists and is not a socket
+ */
+int command_listen(char* path){
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+
+	if(strlen(path) >= sizeof(addr.sun_path))
+		return 1;
+	strcpy(addr.sun_path, path);
+	if(lstat(path, &st) == 0) {
+		if(!S_ISSOCK(st.st_mode))
+			return 2;
+		unlink(path);
+	}
+	if((server = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return 1;
+	if(bind(server, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(server, CLIENT_MAX) < 0) {
+		close(server);
+		server = -1;
+		return 1;
+	}
+	server_path = path;
+	atexit(command_close);
+	signal(SIGPIPE, SIG_IGN);
+	for(int i = 0; i < CLIENT_MAX; i++)
+		clients[i].fd = -1;
+	return 0;
+}
+
+void command_close(){
+	if(server < 0)
+		return;
+	close(server);
+	unlink(server_path);
+	server = -1;
+}
+
+/* 1 while a client is between begin and end */
+int command_batching(){
+	for(int i = 0; i < CLIENT_MAX; i++)
+		if(clients[i].fd >= 0 && clients[i].batch != NULL)
+			return 1;
+	return 0;
+}
+
+/**
+ * Wait for a key or for commands, executing the commands as they come.
+ * Return 1 when a key is ready to be read, 0 after executing commands.
+ */
+int command_poll(){
+	struct pollfd fds[2 + CLIENT_MAX];
+	int n = 0;
+
+	if(server < 0)
+		return 1;
+
+	fds[n++] = (struct pollfd){ .fd = STDIN_FILENO, .events = POLLIN };
+	fds[n++] = (struct pollfd){ .fd = server, .events = POLLIN };
+	for(int i = 0; i < CLIENT_MAX; i++)
+		fds[n++] = (struct pollfd){ .fd = clients[i].fd, .events = POLLIN };
+	if(poll(fds, n, -1) < 0)
+		return 0;
+
+	for(int i = 0; i < CLIENT_MAX; i++)
+		if(fds[2 + i].revents & (POLLIN | POLLHUP | POLLERR))
+			if(!client_read(clients + i))
+				client_close(clients + i);
+
+	if(fds[1].revents & POLLIN) {
+		int fd = accept(server, NULL, NULL);
+		int i;
+		for(i = 0; i < CLIENT_MAX && clients[i].fd >= 0; i++)
+			;
+		if(fd >= 0 && i < CLIENT_MAX && (clients[i].out = fdopen(fd, "w")) != NULL) {
+			clients[i].fd = fd;
+			clients[i].length = 0;
+			clients[i].batch = NULL;
+		} else if(fd >= 0) {
+			close(fd);
+		}
+	}
+
+	return (fds[0].revents & POLLIN) != 0;
+}
+
+#if defined(SYM_BENCH)
+/**
+ * Benchmarks, built by `make bench` into sym-bench.
+ * Every benchmark runs on a fixed, seeded workload and prints one line:
+ *   name iterations ns_per_iteration iterations_per_second
+ * Lines starting with '#' are comments.
+ */
+
+double bench_now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void bench_print(FILE* f, char* name, double n, double seconds){
+	fprintf(f, "%s %.0f %.2f %.0f\n", name, n, seconds * 1e9 / n, n / seconds);
+}
+
+struct Process* bench_process(int pid){
+	struct Process* p = calloc(1, sizeof(struct Process));
+	if(p == NULL)
+		die(__LINE__, "malloc failed");
+	p->pid = pid;
+	return p;
+}
+
+/* insertion in pid order, in random order, then random lookups */
+void bench_process_list(FILE* f, int n){
+	struct Workload w;
+	double t;
+	int i, inserted;
+
+	workload_init(&w);
+	w.random = 1;
+
+	t = bench_now();
+	for(i = 1; i <= n; i++)
+		process_insert(processes, bench_process(i));
+	bench_print(f, "process_insert_sequential", n, bench_now() - t);
+	sim_free(processes);
+
+	t = bench_now();
+	for(i = 1, inserted = 0; i <= n; i++) {
+		struct Process* p = bench_process(workload_random(&w) * INT32_MAX);
+		if(process_insert(processes, p))
+			inserted++;
+		else
+			process_free(p); /* pid already taken */
+	}
+	bench_print(f, "process_insert_random", inserted, bench_now() - t);
+	sim_free(processes);
+
+	for(i = 1; i <= n; i++)
+		process_insert(processes, bench_process(i));
+	t = bench_now();
+	for(i = 0; i < n; i++)
+		if(process_lookup_by_pid(processes, 1 + workload_random(&w) * n) == NULL)
+			die(__LINE__, "lookup failed");
+	bench_print(f, "process_lookup", n, bench_now() - t);
+	sim_free(processes);
+}
+
+/* events per second of the whole simulation, one run per policy */
+void bench_simulation(FILE* f, long count){
+	static char* policies[] = { "fcfs", "rr:4" };
+	char name[STRING_MAX_SIZE];
+	char spec[STRING_MAX_SIZE * 2];
+
+	for(int i = 0; i < SIZE(policies); i++) {
+		sim_init();
+		sim_policy(policies[i]);
+		if((sim.workload = malloc(sizeof(struct Workload))) == NULL)
+			die(__LINE__, "malloc failed");
+		workload_init(sim.workload);
+		sprintf(spec, "seed=1 count=%ld arrival=poisson:0.02 cpu=exp:5 io=exp:20 fanout=exp:0.3", count);
+		workload_parse(sim.workload, spec);
+
+		double t = bench_now();
+		while(sim_step())
+			;
+		t = bench_now() - t;
+		sprintf(name, "simulation_events_%.*s", (int)strcspn(policies[i], ":"), policies[i]);
+		bench_print(f, name, sim.nevents, t);
+		sim_free(processes);
+	}
+}
+
+/* memory allocator with a steady population of live blocks */
+void bench_memory(FILE* f, int n){
+	struct Workload w;
+	struct Hole* blocks;
+	int live = 1024;
+
+	workload_init(&w);
+	w.random = 1;
+	sim_init();
+	memory_init(live * 64);
+	if((blocks = calloc(live, sizeof(struct Hole))) == NULL)
+		die(__LINE__, "malloc failed");
+
+	double t = bench_now();
+	for(int i = 0; i < n; i++) {
+		struct Hole* b = blocks + (int)(workload_random(&w) * live);
+		if(b->size > 0)
+			memory_free(b->address, b->size);
+		b->size = 1 + workload_random(&w) * 63;
+		if((b->address = memory_alloc(b->size)) < 0)
+			b->size = 0;
+	}
+	bench_print(f, "memory_alloc_free", n, bench_now() - t);
+
+	free(blocks);
+	sim_free(processes);
+}
+
+/* drawing of the views, stdout is redirected to /dev/null by bench() */
+void bench_render(FILE* f, int n){
+	struct Process* p = bench_process(1);
+	strcpy(p->name, "benchmark");
+	p->nstages = 8;
+	struct Entry entries[] = {
+		{ .l = "Name",     .t = String,       .v = VOID_PTR( p->name),      .i = 1, .c = NULL },
+		{ .l = "PID",      .t = Integer,      .v = VOID_PTR(&p->pid),       .i = 1, .c = NULL },
+		{ .l = "Arrival",  .t = Long,         .v = VOID_PTR(&p->t_arrival), .i = 1, .c = NULL },
+		{ .l = "Stages",   .t = Integer,      .v = VOID_PTR(&p->nstages),   .i = 1, .c = NULL },
+		{ .l = "",         .t = ProcessStage, .v = VOID_PTR( p->stages),    .i = 1, .c = &p->nstages },
+	};
+	struct Dialog* d = dialog_new(entries, SIZE(entries), 5, 5, term_w - 10, term_h - 10, 10);
+
+	double t = bench_now();
+	for(int i = 0; i < n; i++) {
+		dialog_draw(d);
+		dialog_status();
+		fflush(stdout);
+	}
+	bench_print(f, "render_dialog", n, bench_now() - t);
+
+	t = bench_now();
+	for(int i = 0; i < n; i++) {
+		sim_status();
+		fflush(stdout);
+	}
+	bench_print(f, "render_status", n, bench_now() - t);
+
+	dialog_free(d);
+	free(p);
+}
+
+/**
+ * usage: sym-bench [scale]
+ * scale multiplies the size of every workload, 1 by default.
+ */
+int bench(int argc, char** argv){
+	int scale = argc > 1 ? atoi(argv[1]) : 1;
+	FILE* f;
+
+	if(scale < 1)
+		die(__LINE__, "usage: %s [scale]\n", argv[0]);
+	if((f = fdopen(dup(STDOUT_FILENO), "w")) == NULL || freopen("/dev/null", "w", stdout) == NULL)
+		die(__LINE__, "can't redirect stdout\n");
+	term_w = 80;
+	term_h = 24;
+
+	fprintf(f, "# name iterations ns_per_iteration iterations_per_second\n");
+	bench_process_list(f, 10000 * scale);
+	bench_simulation(f, 100000L * scale);
+	bench_memory(f, 1000000 * scale);
+	bench_render(f, 10000 * scale);
+
+	fclose(f);
+	return 0;
+}
+#endif /* SYM_BENCH */
+
+int main(int argc, char** argv){
+
+	long until = -1;
+	int batch = 0;
+	int commands = 0;
+	char* socket_path = NULL;
+	int r;
+
+	processes = calloc(1, sizeof(struct Process));
+	if(processes == NULL)
+		die(__LINE__, "malloc failed");
+	sim_init();
+
+#if defined(SYM_BENCH)
+	return bench(argc, argv);
+#endif
+
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-b")) {
+			batch = 1;
+		} else if(!strcmp(argv[i], "-r") && i + 1 < argc) {
+			if(snapshot_restore(processes, argv[++i]))
+				die(__LINE__, "can't restore snapshot %s\n", argv[i]);
+		} else if(!strcmp(argv[i], "-w") && i + 1 < argc) {
+			struct Workload* w = malloc(sizeof(struct Workload));
+			if(w == NULL)
+				die(__LINE__, "malloc failed");
+			workload_init(w);
+			if(workload_parse(w, argv[++i]))
+				die(__LINE__, "invalid workload %s\n", argv[i]);
+			free(sim.workload);
+			sim.workload = w;
+			sim.pending = NULL;
+		} else if(!strcmp(argv[i], "-p") && i + 1 < argc) {
+			if(sim_policy(argv[++i]))
+				die(__LINE__, "invalid policy %s\n", argv[i]);
+		} else if(!strcmp(argv[i], "-m") && i + 1 < argc) {
+			if(sim.memory_used > 0 || (r = atoi(argv[++i])) < 0)
+				die(__LINE__, "can't resize memory\n");
+			memory_init(r);
+		} else if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+			until = atol(argv[++i]);
+		} else if(!strcmp(argv[i], "-c")) {
+			commands = 1;
+		} else if(!strcmp(argv[i], "-S") && i + 1 < argc) {
+			socket_path = argv[++i];
+		} else {
+			die(__LINE__, "usage: %s [-b] [-r snapshot] [-w workload] [-p fcfs|rr:quantum] [-m memory] [-t time] [-c] [-S socket]\n", argv[0]);
+		}
+	}
+
+	if(batch && commands) {
+		struct Client c = { .fd = STDIN_FILENO, .out = stdout };
+		history_init(HISTORY_INTERVAL);
+		while(client_read(&c))
+			;
+		return 0;
+	} else if(batch) {
+		while((until < 0 || sim.t_now < until) && sim_step())
+			;
+		sim_report(stdout, " ", "\n");
+		putchar('\n');
+#if defined(SYM_PROFILE)
+		profile_report(stdout, " ", "\n");
+		putchar('\n');
+#endif
+		return 0;
+	}
+
+	if(socket_path != NULL && command_listen(socket_path))
+		die(__LINE__, "can't listen on %s\n", socket_path);
+	initwin();
+	history_init(HISTORY_INTERVAL);
+
+	struct Mutation m;
+	struct Until u = { .interrupt = 1 };
+	char key;
+#if defined(SYM_PROFILE)
+	int overlay = 0;
+#endif
+	setvbuf(stdin, NULL, _IONBF, 0); /* keys are polled on the descriptor */
+	while(1) {
+		if(!command_poll()) { /* commands changed the simulation, redraw once per batch */
+			if(command_batching())
+				continue;
+			sim_status();
+#if defined(SYM_PROFILE)
+			if(overlay)
+				profile_draw();
+#endif
+			screen_flush();
+			continue;
+		}
+		key = getchar();
+		PROFILE_BEGIN(ProfileCommand);
+		switch(key) {
+		case KEY_PROCESS_NEW:
+			m = (struct Mutation){ .type = MutationProcess, .p = process_dialog_new() };
+			PROFILE_RESTART(ProfileCommand);
+			printf("%d", !history_apply(&m));
+			break;
+		case KEY_STEP:
+			history_step();
+			sim_status();
+			break;
+		case KEY_BACK:
+			history_back();
+			sim_status();
+			break;
+		case KEY_RUN:
+			until_dialog(&u);
+			PROFILE_RESTART(ProfileCommand);
+			printf("%d", sim_run(&u));
+			sim_status();
+			break;
+		case KEY_SNAPSHOT_SAVE:
+			printf("%d", snapshot_write(processes, SNAPSHOT_PATH));
+			break;
+		case KEY_SNAPSHOT_LOAD:
+			printf("%d", snapshot_restore(processes, SNAPSHOT_PATH));
+			history_init(HISTORY_INTERVAL);
+			break;
+#if defined(SYM_PROFILE)
+		case KEY_PROFILE:
+			overlay = !overlay;
+			if(!overlay)
+				repaint();
 			break;
+#endif
 		case KEY_QUIT:
 			endwin();
 			return 0;
 		}
+		PROFILE_END(ProfileCommand);
+#if defined(SYM_PROFILE)
+		if(overlay)
+			profile_draw();
+#endif
+		screen_flush();
 	}
 
 }